@@ -3,6 +3,10 @@
 /* ################################################## Standard includes ################################################# */
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <stdio.h>
 /* ################################################### Project includes ################################################# */
 #include "../FreeRTOS/Source/include/FreeRTOS.h"
 #include "../FreeRTOS/Source/include/task.h"
@@ -18,56 +22,225 @@
 #define MOTOR_CONTROL_PWM_FREQ	5000L
 #define MOTOR_CONTROL_PRESCALER	1L
 #define MOTOR_CONTROL_TOP		(F_CPU/(MOTOR_CONTROL_PWM_FREQ * MOTOR_CONTROL_PRESCALER)-1L)
+// Default ramps [per mille/s], full speed in 0.5 s and full brake in 0.2 s
+#define MOTOR_CONTROL_DEFAULT_ACCEL	2000U
+#define MOTOR_CONTROL_DEFAULT_BRAKE	5000U
 
-#define DIALOG_HANDLER_FREQ			100L  // Scaled down to 10 Hz in ISR
-#define DIALOG_HANDLER_PRESCALER	1024L
+// Compare value per mille duty cycle, generated at compile time
+#define _MOTOR_DUTY(p)		((uint16_t)(((p) * MOTOR_CONTROL_TOP + 500L) / 1000L))
+#define _MOTOR_DUTY_10(p)	_MOTOR_DUTY(p), _MOTOR_DUTY((p) + 1), _MOTOR_DUTY((p) + 2), _MOTOR_DUTY((p) + 3), _MOTOR_DUTY((p) + 4), \
+							_MOTOR_DUTY((p) + 5), _MOTOR_DUTY((p) + 6), _MOTOR_DUTY((p) + 7), _MOTOR_DUTY((p) + 8), _MOTOR_DUTY((p) + 9)
+#define _MOTOR_DUTY_100(p)	_MOTOR_DUTY_10(p), _MOTOR_DUTY_10((p) + 10), _MOTOR_DUTY_10((p) + 20), _MOTOR_DUTY_10((p) + 30), _MOTOR_DUTY_10((p) + 40), \
+							_MOTOR_DUTY_10((p) + 50), _MOTOR_DUTY_10((p) + 60), _MOTOR_DUTY_10((p) + 70), _MOTOR_DUTY_10((p) + 80), _MOTOR_DUTY_10((p) + 90)
+#define _MOTOR_DUTY_1000(p)	_MOTOR_DUTY_100(p), _MOTOR_DUTY_100((p) + 100), _MOTOR_DUTY_100((p) + 200), _MOTOR_DUTY_100((p) + 300), _MOTOR_DUTY_100((p) + 400), \
+							_MOTOR_DUTY_100((p) + 500), _MOTOR_DUTY_100((p) + 600), _MOTOR_DUTY_100((p) + 700), _MOTOR_DUTY_100((p) + 800), _MOTOR_DUTY_100((p) + 900)
+
+static const uint16_t _motor_duty[1001] PROGMEM = {_MOTOR_DUTY_1000(0L), _MOTOR_DUTY(1000L)};
+
+// Motor ramp: per mille, positive is drive and negative is brake
+#define _MOTOR_RAMP_STEP(rate)	((int32_t)(((uint32_t)(rate) << 16) / MOTOR_CONTROL_PWM_FREQ))
+static volatile int16_t _motor_target = 0;
+static volatile int32_t _motor_output_q16 = 0;
+static volatile int32_t _motor_accel_step_q16 = _MOTOR_RAMP_STEP(MOTOR_CONTROL_DEFAULT_ACCEL);
+static volatile int32_t _motor_brake_step_q16 = _MOTOR_RAMP_STEP(MOTOR_CONTROL_DEFAULT_BRAKE);
+
+#define DIALOG_HANDLER_FREQ			1000L  // Scaled down to 10 Hz in ISR
+#define DIALOG_HANDLER_PRESCALER	64L
 #define DIALOG_HANDLER_TOP		(F_CPU/(DIALOG_HANDLER_FREQ * DIALOG_HANDLER_PRESCALER)-1L)
+#define DIALOG_HANDLER_US_PER_COUNT	(1000000L * DIALOG_HANDLER_PRESCALER / F_CPU)
+
+// _time_us() needs a whole no of us per count and a compare match exactly every ms
+#if ((1000000L * DIALOG_HANDLER_PRESCALER) % F_CPU) || ((DIALOG_HANDLER_TOP + 1) * DIALOG_HANDLER_US_PER_COUNT != 1000000L / DIALOG_HANDLER_FREQ) || (DIALOG_HANDLER_TOP > 255)
+#error "DIALOG_HANDLER_PRESCALER does not give a 1 ms compare match with a whole no of us per count"
+#endif
 
 // MPU-9250 Gyro/Acc definitions
 // Read bit or to register address to read from it
 #define	MPU9520_READ				0x80
 
 // MPU-9250 Registers
+#define MPU9520_SMPLRT_DIV_REG		0x19
+#define MPU9520_CONFIG_REG			0x1A
 #define MPU9520_GYRO_CONFIG_REG		0x1B
 #define MPU9520_ACCEL_CONFIG_REG	0x1C
+#define MPU9520_ACCEL_CONFIG2_REG	0x1D
+#define MPU9520_FIFO_EN_REG			0x23
+#define MPU9520_INT_PIN_CFG_REG		0x37
+#define MPU9520_INT_ENABLE_REG		0x38
 #define MPU9520_ACCEL_XOUT_H_REG	0x3B
-#define MPU9520_GYRO_XOUT_H_REG		0x43
+#define MPU9520_USER_CTRL_REG		0x6A
+#define MPU9520_PWR_MGMT_1_REG		0x6B
+#define MPU9520_FIFO_COUNTH_REG		0x72
+#define MPU9520_FIFO_R_W_REG		0x74
+
+#define PWR_MGMT_1_CLKSEL_PLL		0x01
+#define CONFIG_FIFO_MODE_STOP		0x40  // Do not overwrite old samples when the FIFO is full
+#define FIFO_EN_ACC_TEMP_GYRO		0xF8  // Same layout as the ACCEL_XOUT_H burst
+#define USER_CTRL_FIFO_EN			0x40
+#define USER_CTRL_I2C_IF_DIS		0x10
+#define USER_CTRL_FIFO_RST			0x04
+#define INT_PIN_CFG_ACTIVE_HIGH		0x00  // Push-pull, 50 us pulse
+#define INT_ENABLE_RAW_RDY_EN		0x01
+
+// Sample rate = internal rate/(1 + SMPLRT_DIV) when the DLPF is on
+#define MPU9520_INTERNAL_RATE_HZ	1000
+#define MPU9520_DEFAULT_RATE_HZ		1000
+// ACCEL_XOUT_H to GYRO_ZOUT_L: acc, temperature and gyro
+#define MPU9520_SAMPLE_BYTES		14
+
+// FIFO mode
+#define MPU9520_FIFO_SIZE			512
+#define MPU9520_FIFO_FULL			((MPU9520_FIFO_SIZE / MPU9520_SAMPLE_BYTES) * MPU9520_SAMPLE_BYTES)
+// The FIFO is drained when it holds this many samples, max MPU9520_FIFO_MAX_BATCH in one burst
+#define MPU9520_FIFO_WATERMARK		8
+#define MPU9520_FIFO_MAX_BATCH		16
+// Samples waiting for the consumer task
+#define IMU_FIFO_RING_SAMPLES		32
 
+// Full scale is +/-32768 LSB
+// [centi-dps/LSB] in Q12 = full scale [dps] * 100/8
 #define GYRO_FULL_SCALE_250_DPS		0x00
-#define GYRO_250_DPS_DIVIDER		131.0
+#define GYRO_250_DPS_CDPS_Q12		(250 * 100 / 8)
 #define GYRO_FULL_SCALE_500_DPS		0x08
-#define GYRO_500_DPS_DIVIDER		65.5
+#define GYRO_500_DPS_CDPS_Q12		(500 * 100 / 8)
 #define GYRO_FULL_SCALE_1000_DPS	0x10
-#define GYRO_1000_DPS_DIVIDER		32.8
+#define GYRO_1000_DPS_CDPS_Q12		(1000 * 100 / 8)
 #define GYRO_FULL_SCALE_2000_DPS	0x18
-#define GYRO_2000_DPS_DIVIDER		16.4
+#define GYRO_2000_DPS_CDPS_Q12		(2000 * 100 / 8)
 
+// [mg/LSB] in Q15 = full scale [mg]
 #define ACC_FULL_SCALE_2_G			0x00
-#define ACC_2G_DIVIDER				16384
+#define ACC_2G_MG_Q15				2000
 #define ACC_FULL_SCALE_4_G			0x08
-#define ACC_4G_DIVIDER				8192
+#define ACC_4G_MG_Q15				4000
 #define ACC_FULL_SCALE_8_G			0x10
-#define ACC_8G_DIVIDER				4096
+#define ACC_8G_MG_Q15				8000
 #define ACC_FULL_SCALE_16_G			0x18
-#define ACC_16G_DIVIDER				2048
+#define ACC_16G_MG_Q15				16000
+// 1 g in the 2 g range [LSB]
+#define ACC_1G_2G_RANGE				16384
 
-typedef enum {_mpu9520_init_acc,_mpu9520_init_gyro, _mpu9520_poll_acc, _mpu9520_read_acc, _mpu9520_poll_gyro, _mpu9520_read_gyro} _mpu9520_states_t;
+// Configuration registers max 1 MHz, sensor registers max 20 MHz
+#define MPU9520_CONFIG_CLOCK		SPI_CLOCK_DIVIDER_16
+#define MPU9520_DATA_CLOCK			SPI_CLOCK_DIVIDER_2
 
 // Handle to SPI
 static spi_p _spi_mpu9520 = 0;
 static serial_p _bt_serial_instance = 0;
 
-// mpu9520
-static buffer_struct_t _mpu9520_rx_buffer;
-static buffer_struct_t _mpu9250_tx_buffer;
+// mpu9520 transactions
+// Written in this order by the configuration transaction
+static uint8_t _mpu9520_config_regs[][2] = {
+	{MPU9520_PWR_MGMT_1_REG, PWR_MGMT_1_CLKSEL_PLL},
+	{MPU9520_USER_CTRL_REG, USER_CTRL_I2C_IF_DIS},
+	{MPU9520_SMPLRT_DIV_REG, 0},
+	{MPU9520_CONFIG_REG, 1},
+	{MPU9520_GYRO_CONFIG_REG, GYRO_FULL_SCALE_500_DPS},
+	{MPU9520_ACCEL_CONFIG_REG, ACC_FULL_SCALE_2_G},
+	{MPU9520_ACCEL_CONFIG2_REG, 1},
+	{MPU9520_INT_PIN_CFG_REG, INT_PIN_CFG_ACTIVE_HIGH},
+	{MPU9520_FIFO_EN_REG, 0},
+	{MPU9520_USER_CTRL_REG, USER_CTRL_I2C_IF_DIS},
+	{MPU9520_INT_ENABLE_REG, INT_ENABLE_RAW_RDY_EN}
+};
+#define MPU9520_NO_OF_CONFIG_REGS	(sizeof _mpu9520_config_regs / sizeof _mpu9520_config_regs[0])
+// Row in _mpu9520_config_regs
+#define MPU9520_SMPLRT_DIV_ROW		2
+#define MPU9520_CONFIG_ROW			3
+#define MPU9520_GYRO_CONFIG_ROW		4
+#define MPU9520_ACCEL_CONFIG_ROW	5
+#define MPU9520_ACCEL_CONFIG2_ROW	6
+#define MPU9520_FIFO_EN_ROW			8
+#define MPU9520_FIFO_CTRL_ROW		9
+#define MPU9520_INT_ENABLE_ROW		10
+static volatile int8_t _mpu9520_config_index = 0;
+
+// Lowest sample rate for the DLPF settings 1..5, the bandwidth must be below half the sample rate
+static const uint16_t _mpu9520_dlpf_min_rate[] = {437, 198, 90, 43, 21};
+static uint8_t _mpu9520_sample_tx[MPU9520_SAMPLE_BYTES + 1] = {MPU9520_READ | MPU9520_ACCEL_XOUT_H_REG};
+static uint8_t _mpu9520_sample_rx[MPU9520_SAMPLE_BYTES + 1];
+static spi_transaction_t _mpu9520_config;
+static spi_transaction_t _mpu9520_read_sample;
+static uint32_t _mpu9520_sample_time = 0;
+static uint32_t _mpu9520_sample_period_us = 1000;
+
+// FIFO mode transactions
+static uint8_t _mpu9520_fifo_count_tx[3] = {MPU9520_READ | MPU9520_FIFO_COUNTH_REG};
+static uint8_t _mpu9520_fifo_count_rx[3];
+static uint8_t _mpu9520_fifo_tx[1] = {MPU9520_READ | MPU9520_FIFO_R_W_REG};
+static uint8_t _mpu9520_fifo_rx[1 + MPU9520_FIFO_MAX_BATCH * MPU9520_SAMPLE_BYTES];
+static uint8_t _mpu9520_fifo_reset_tx[2] = {MPU9520_USER_CTRL_REG, USER_CTRL_I2C_IF_DIS | USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RST};
+static spi_transaction_t _mpu9520_fifo_count;
+static spi_transaction_t _mpu9520_fifo_read;
+static spi_transaction_t _mpu9520_fifo_reset;
+static uint32_t _mpu9520_fifo_time = 0; // time of the FIFO count read
+static uint16_t _mpu9520_fifo_samples = 0; // samples in the FIFO at the count read
+static uint16_t _mpu9520_fifo_poll_ms = 1; // FIFO count read interval
+
+// FIFO samples to the consumer task
+static TaskHandle_t _imu_fifo_task = NULL;
+static buffer_struct_t _imu_fifo_buffer;
+static uint8_t _imu_fifo_storage[IMU_FIFO_RING_SAMPLES * sizeof(imu_sample_t)];
+
+// Bluetooth
+#define BT_RX_BUFFER_SIZE		64
+#define BT_TX_BUFFER_SIZE		128
+#define BT_RX_HIGH_WATERMARK	(BT_RX_BUFFER_SIZE * 3 / 4)
+#define BT_RX_LOW_WATERMARK		(BT_RX_BUFFER_SIZE / 4)
+// The rx task is notified when the line gets idle, or at this fill level
+#define BT_RX_IDLE_BITS			30
+#define BT_RX_NOTIFY_LEVEL		(BT_RX_BUFFER_SIZE / 2)
+static buffer_struct_t _bt_rx_buffer;
+static buffer_struct_t _bt_tx_buffer;
+static uint8_t _bt_rx_storage[BT_RX_BUFFER_SIZE];
+static uint8_t _bt_tx_storage[BT_TX_BUFFER_SIZE];
+
+// Newest sample, written from ISR only - odd _imu_seq while it is written
+static imu_sample_t _imu_sample;
+static volatile uint8_t _imu_seq = 0;
+// Full scale ranges in the sensor, the conversion factors are doubled per step
+static volatile uint8_t _acc_range = board_ACC_RANGE_2G;
+static volatile uint8_t _gyro_range = board_GYRO_RANGE_500_DPS;
+
+// Bias offsets in the 2 g and 250 degrees/s ranges, persisted in EEPROM
+#define IMU_CALIBRATION_MAGIC		0xCA1B
+typedef struct {
+	uint16_t magic;
+	int16_t acc[3];
+	int16_t gyro[3];
+	uint8_t checksum;
+} _imu_calibration_t;
+static _imu_calibration_t EEMEM _ee_imu_calibration;
+static _imu_calibration_t _imu_calibration;
+// Offsets in the current ranges, subtracted from each sample
+static int16_t _acc_offset[3];
+static int16_t _gyro_offset[3];
+// Calibration running while samples are left
+static volatile uint16_t _imu_calibration_samples = 0;
+static int32_t _acc_sum[3];
+static int32_t _gyro_sum[3];
+// Keep the compiler from moving the sample copy across _imu_seq
+#define MEMORY_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+static uint32_t _imu_sequence = 0;
 
-static int16_t _x_acc = 0;
-static int16_t _y_acc = 0;
-static int16_t _z_acc = 0;
+// Milliseconds counted by the dialog handler timer
+static volatile uint32_t _time_ms = 0;
 
-static int16_t _x_gyro = 0;
-static int16_t _y_gyro = 0;
-static int16_t _z_gyro = 0;
+// Tacho edge timing
+// Speed is 0 when no edge is seen in this time
+#define TACHO_STOP_TIMEOUT_US	500000UL
+// Filtered period = old + (new - old)/2^TACHO_FILTER_SHIFT
+#define TACHO_FILTER_SHIFT		3
+static uint32_t _tacho_last_edge_us = 0;
+static uint8_t _tacho_have_edge = 0; // _tacho_last_edge_us is the time of a real edge
+static uint32_t _tacho_period_us = 0; // between the last two edges, 0: not measured yet
+static uint32_t _tacho_filtered_period_us = 0;
+static uint16_t _tacho_last_tcnt = 0;
+
+// Odometry - Timer 1 overflows extend the tacho count to 32 bits
+static volatile uint16_t _tacho_overflows = 0;
+static uint32_t _lap_start_count = 0;
+static uint32_t _last_lap_count = 0;
 
 // dialog sequences to setup BT module
 typedef enum { eENTER_CMD0=0, eENTER_CMD1, eAUTHENTICATION, eNAME, eREBOOT1, eREBOOT2 } en_init_dialog_states;
@@ -84,20 +257,32 @@ dialog_seq_t _dialog_bt_init_seq[] = {
 static uint8_t _bt_dialog_active = 0;
 // Pointer to Application BT call back functions
 static void (*_app_bt_status_call_back)(uint8_t result) = NULL;
-static QueueHandle_t _xRxedCharsQ = NULL;
+static TaskHandle_t _bt_rx_task = NULL;
+static volatile uint8_t _bt_rx_unnotified = 0; // bytes received that the rx task is not notified about
+static uint8_t _bt_rx_above_notify_level = 0; // rx buffer at or above BT_RX_NOTIFY_LEVEL, the rx task is notified
 
 // Semaphore to be given when the goal line is passed.
 static SemaphoreHandle_t  _goal_line_semaphore = NULL;
 
 /* ################################################# Function prototypes ################################################ */
 static void _init_mpu9520();
-static void _mpu9250_write_2_reg(uint8_t reg, uint8_t value);
-static void _mpu9250_call_back(spi_p spi_instance, uint8_t spi_last_received_byte);
+static uint32_t _time_us();
+static uint32_t _tacho_speed(uint32_t period_us);
+static uint32_t _tacho_total_count();
+static void _mpu9250_configure();
+static void _mpu9250_config_done(spi_transaction_t *transaction);
+static void _mpu9250_read_done(spi_transaction_t *transaction);
+static void _imu_load_calibration();
+static void _imu_update_offsets();
+static void _mpu9250_fifo_poll();
+static void _mpu9250_fifo_count_done(spi_transaction_t *transaction);
+static void _mpu9250_fifo_read_done(spi_transaction_t *transaction);
 static void _bt_call_back(serial_p _bt_serial_instance, uint8_t serial_last_received_byte);
+static void _bt_frame_call_back(serial_p _bt_serial_instance, uint16_t no_of_bytes);
 static void	_init_dialog_handler_timer();
 
 // ----------------------------------------------------------------------------------------------------------------------
-void init_main_board() {
+uint8_t init_main_board() {
 	// HORN
 	*(&HORN_PORT_reg - 1) |= _BV(HORN_PIN_bit); // set pin to output
 
@@ -142,6 +327,10 @@ void init_main_board() {
 	// TACHO Counter
 	// External Clock source - Falling Edge
 	TACHO_TCCRB_reg |= _BV(TACHO_CS2_bit) | _BV(TACHO_CS1_bit);
+	// Compare match on the next edge to time it
+	_tacho_last_tcnt = TACHO_TCNT_reg;
+	TACHO_OCRA_reg = _tacho_last_tcnt + 1;
+	TACHO_TIMSK_reg |= _BV(TACHO_OCIEA_bit) | _BV(TACHO_TOIE_bit);
 	
 	// Bluetooth
 	*(&BT_RTS_PORT - 1) &= ~_BV(BT_RTS_PIN); // set pin to input
@@ -161,14 +350,20 @@ void init_main_board() {
 	EICRA |= _BV(ISC01);
 	EIMSK |= _BV(INT0);
 	
-	static buffer_struct_t _bt_rx_buffer;
-	static buffer_struct_t _bt_tx_buffer;
-	buffer_init(&_bt_rx_buffer);
-	buffer_init(&_bt_tx_buffer);
+	buffer_init_spsc(&_bt_rx_buffer, _bt_rx_storage, BT_RX_BUFFER_SIZE);
+	buffer_init_spsc(&_bt_tx_buffer, _bt_tx_storage, BT_TX_BUFFER_SIZE);
 	_bt_serial_instance = serial_new_instance(ser_USART0, 57000UL, ser_BITS_8, ser_STOP_1, ser_NO_PARITY, &_bt_rx_buffer, &_bt_tx_buffer, _bt_call_back);
+	if (_bt_serial_instance) {
+		// PIN register is two below the PORT register
+		serial_set_flow_control(_bt_serial_instance, &BT_CTS_PORT, BT_CTS_PIN, &BT_RTS_PORT - 2, BT_RTS_PIN, BT_RX_HIGH_WATERMARK, BT_RX_LOW_WATERMARK);
+		serial_set_idle_detection(_bt_serial_instance, BT_RX_IDLE_BITS, _bt_frame_call_back);
+	}
 	
 	_init_mpu9520();
 	_init_dialog_handler_timer();
+	
+	// Baud rate cannot be made with this F_CPU
+	return _bt_serial_instance ? BOARD_OK : BOARD_BT_INIT_FAILED;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
@@ -201,19 +396,111 @@ void set_brake_light(uint8_t state){
 	}
 }
 
+// ----------------------------------------------------------------------------------------------------------------------
+// Both compare values are written in one critical section, so they are used from the same PWM period
+// and the 16 bit writes are not split by an ISR using the timer
+static void _set_motor_compare(uint16_t ocra, uint16_t ocrb) {
+	uint8_t _sreg = SREG;
+	cli();
+	MOTOR_CONTROL_OCRA_reg = ocra;
+	MOTOR_CONTROL_OCRB_reg = ocrb;
+	SREG = _sreg;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void _set_motor_output(int16_t output_permille) {
+	if (output_permille >= 0) {
+		uint16_t _duty = pgm_read_word(&_motor_duty[output_permille]);
+		_set_motor_compare(_duty, _duty);
+		} else {
+		_set_motor_compare(pgm_read_word(&_motor_duty[-output_permille]), 0);
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// The ramp towards the target is run by the overflow ISR
+static void _set_motor_target(int16_t target_permille) {
+	uint8_t _sreg = SREG;
+	cli();
+	_motor_target = target_permille;
+	if (((int32_t)target_permille << 16) == _motor_output_q16) {
+		_set_motor_output(target_permille);
+		} else {
+		MOTOR_CONTROL_TIMSK_reg |= _BV(MOTOR_CONTROL_TOIE_bit);
+	}
+	SREG = _sreg;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void set_motor_speed_permille(uint16_t speed_permille){
+	if (speed_permille > 1000) {
+		speed_permille = 1000;
+	}
+	
+	// 0: Free Run
+	_set_motor_target(speed_permille);
+}
+
 // ----------------------------------------------------------------------------------------------------------------------
 void set_motor_speed(uint8_t speed_percent){
 	if (speed_percent > 100) {
 		speed_percent = 100;
 	}
 	
-	if  (speed_percent > 0) {
-		MOTOR_CONTROL_OCRA_reg = speed_percent*MOTOR_CONTROL_TOP/100;
-		MOTOR_CONTROL_OCRB_reg = speed_percent*MOTOR_CONTROL_TOP/100;
-		} else { // Free Run
-		MOTOR_CONTROL_OCRA_reg = 0;
-		MOTOR_CONTROL_OCRB_reg = 0;
+	set_motor_speed_permille(speed_percent * 10U);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void set_brake_permille(uint16_t brake_permille) {
+	if (brake_permille > 1000) {
+		brake_permille = 1000;
 	}
+	
+	// 0: Free Run
+	_set_motor_target(-(int16_t)brake_permille);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void set_motor_ramp(uint16_t accel_permille_per_s, uint16_t brake_permille_per_s) {
+	int32_t _accel = _MOTOR_RAMP_STEP(accel_permille_per_s);
+	int32_t _brake = _MOTOR_RAMP_STEP(brake_permille_per_s);
+	
+	uint8_t _sreg = SREG;
+	cli();
+	_motor_accel_step_q16 = _accel;
+	_motor_brake_step_q16 = _brake;
+	SREG = _sreg;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_motor_output_permille() {
+	uint8_t _sreg = SREG;
+	cli();
+	int32_t _tmp = _motor_output_q16;
+	SREG = _sreg;
+	return _tmp >> 16;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Motor PWM at TOP - one ramp step per PWM period, the compare values are used from the next period
+ISR(MOTOR_CONTROL_OVF_vect) {
+	int32_t _target = (int32_t)_motor_target << 16;
+	int32_t _output = _motor_output_q16;
+	
+	if (_output < _target) {
+		int32_t _step = _motor_accel_step_q16;
+		_output = (_step == 0 || _target - _output <= _step) ? _target : _output + _step;
+		} else if (_output > _target) {
+		int32_t _step = _motor_brake_step_q16;
+		_output = (_step == 0 || _output - _target <= _step) ? _target : _output - _step;
+	}
+	
+	// Converged - no more interrupts until a new target is set
+	if (_output == _target) {
+		MOTOR_CONTROL_TIMSK_reg &= ~_BV(MOTOR_CONTROL_TOIE_bit);
+	}
+	_motor_output_q16 = _output;
+	_set_motor_output(_output >> 16);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
@@ -222,248 +509,606 @@ void set_brake(uint8_t brake_percent) {
 		brake_percent = 100;
 	}
 	
-	if  (brake_percent > 0) {
-		MOTOR_CONTROL_OCRA_reg = brake_percent*MOTOR_CONTROL_TOP/100;
-		MOTOR_CONTROL_OCRB_reg = 0;
-		} else { // Free Run
-		MOTOR_CONTROL_OCRA_reg = 0;
-		MOTOR_CONTROL_OCRB_reg = 0;
+	set_brake_permille(brake_percent * 10U);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void get_imu_sample(imu_sample_t *sample) {
+	uint8_t _seq;
+	
+	// Copy again if a new sample was published while copying
+	do {
+		_seq = _imu_seq;
+		MEMORY_BARRIER();
+		*sample = _imu_sample;
+		MEMORY_BARRIER();
+	} while ((_seq & 1) || (_seq != _imu_seq));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t imu_raw_to_mg(int16_t raw, board_acc_range_t range) {
+	// Rounded
+	uint16_t _mg_per_lsb_q15 = ACC_2G_MG_Q15 << range;
+	
+	return ((int32_t)raw * _mg_per_lsb_q15 + (1L << 14)) >> 15;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int32_t imu_raw_to_cdps(int16_t raw, board_gyro_range_t range) {
+	// Rounded
+	uint16_t _cdps_per_lsb_q12 = GYRO_250_DPS_CDPS_Q12 << range;
+	
+	return ((int32_t)raw * _cdps_per_lsb_q12 + (1L << 11)) >> 12;
+}
+
+#if IMU_CONVERSION_BENCHMARK == 1
+#define IMU_BENCHMARK_CALLS			1000UL
+
+// Volatile so the conversions are not optimised away
+static volatile int16_t _imu_benchmark_raw = -12345;
+static volatile int32_t _imu_benchmark_fixed;
+static volatile float _imu_benchmark_float;
+
+// The conversions measured, called through a pointer so they all have the same call overhead as the empty one
+static void _imu_benchmark_empty(void) { _imu_benchmark_fixed = _imu_benchmark_raw; }
+static void _imu_benchmark_mg(void) { _imu_benchmark_fixed = imu_raw_to_mg(_imu_benchmark_raw, board_ACC_RANGE_2G); }
+static void _imu_benchmark_cdps(void) { _imu_benchmark_fixed = imu_raw_to_cdps(_imu_benchmark_raw, board_GYRO_RANGE_500_DPS); }
+static void _imu_benchmark_float_mul(void) { _imu_benchmark_float = imu_raw_to_mg(_imu_benchmark_raw, board_ACC_RANGE_2G) * 0.001f; }
+static void _imu_benchmark_float_div(void) { _imu_benchmark_float = _imu_benchmark_raw / 16384.0f; }
+
+// ----------------------------------------------------------------------------------------------------------------------
+static uint32_t _imu_benchmark_us(void (*conversion)(void)) {
+	uint32_t _start_us = get_time_us();
+	
+	for (uint16_t i = 0; i < IMU_BENCHMARK_CALLS; i++) {
+		conversion();
+	}
+	
+	return get_time_us() - _start_us;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Cycles per call with the empty loop subtracted
+static uint16_t _imu_benchmark_cycles(void (*conversion)(void), uint32_t empty_us) {
+	uint32_t _us = _imu_benchmark_us(conversion);
+	
+	if (_us <= empty_us) {
+		return 0;
 	}
+	
+	return ((_us - empty_us) * (F_CPU / 1000000UL) + IMU_BENCHMARK_CALLS / 2) / IMU_BENCHMARK_CALLS;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint8_t bt_send_imu_conversion_benchmark(void) {
+	static char _line[80];
+	uint32_t _empty_us = _imu_benchmark_us(_imu_benchmark_empty);
+	uint16_t _mg = _imu_benchmark_cycles(_imu_benchmark_mg, _empty_us);
+	uint16_t _cdps = _imu_benchmark_cycles(_imu_benchmark_cdps, _empty_us);
+	uint16_t _float = _imu_benchmark_cycles(_imu_benchmark_float_mul, _empty_us);
+	uint16_t _div = _imu_benchmark_cycles(_imu_benchmark_float_div, _empty_us);
+	
+	int _len = snprintf(_line, sizeof _line, "IMU cycles mg:%u cdps:%u float:%u div:%u\r\n", _mg, _cdps, _float, _div);
+	
+	return bt_send_bytes((uint8_t *)_line, _len);
+}
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_x_accel_mg() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return imu_raw_to_mg(_sample.acc_x, _sample.acc_range);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 float get_x_accel() {
-	uint8_t _sreg = SREG;
-	cli();
-	float _tmp = ((float)_x_acc)/ACC_2G_DIVIDER;
-	SREG = _sreg;
-	return _tmp;
+	return get_x_accel_mg() * 0.001f;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_y_accel_mg() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return imu_raw_to_mg(_sample.acc_y, _sample.acc_range);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 float get_y_accel() {
-	uint8_t _sreg = SREG;
-	cli();
-	float _tmp = ((float)_y_acc)/ACC_2G_DIVIDER;
-	SREG = _sreg;
-	return _tmp;
+	return get_y_accel_mg() * 0.001f;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_z_accel_mg() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return imu_raw_to_mg(_sample.acc_z, _sample.acc_range);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 float get_z_accel() {
-	uint8_t _sreg = SREG;
-	cli();
-	float _tmp = ((float)_z_acc)/ACC_2G_DIVIDER;
-	SREG = _sreg;
-	return _tmp;
+	return get_z_accel_mg() * 0.001f;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 int16_t get_raw_x_accel() {
-	uint8_t _sreg = SREG;
-	cli();
-	int16_t _tmp = _x_acc;
-	SREG = _sreg;
-	return _tmp;
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return _sample.acc_x;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 int16_t get_raw_y_accel() {
-	uint8_t _sreg = SREG;
-	cli();
-	int16_t _tmp = _y_acc;
-	SREG = _sreg;
-	return _tmp;
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return _sample.acc_y;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 int16_t get_raw_z_accel() {
-	uint8_t _sreg = SREG;
-	cli();
-	int16_t _tmp = _z_acc;
-	SREG = _sreg;
-	return _tmp;
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return _sample.acc_z;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int32_t get_x_rotation_cdps() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return imu_raw_to_cdps(_sample.gyro_x, _sample.gyro_range);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
 float get_x_rotation() {
+	return get_x_rotation_cdps() * 0.01f;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int32_t get_y_rotation_cdps() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return imu_raw_to_cdps(_sample.gyro_y, _sample.gyro_range);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+float get_y_rotation() {
+	return get_y_rotation_cdps() * 0.01f;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int32_t get_z_rotation_cdps() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return imu_raw_to_cdps(_sample.gyro_z, _sample.gyro_range);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+float get_z_rotation() {
+	return get_z_rotation_cdps() * 0.01f;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_raw_x_rotation() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return _sample.gyro_x;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_raw_y_rotation() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return _sample.gyro_y;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int16_t get_raw_z_rotation() {
+	imu_sample_t _sample;
+	get_imu_sample(&_sample);
+	return _sample.gyro_z;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void _init_mpu9520() {
+	// The instance runs with the slow configuration clock, the reads use their own
+	_spi_mpu9520 = spi_new_instance(SPI_MODE_MASTER, MPU9520_CONFIG_CLOCK, 3, SPI_DATA_ORDER_MSB, &PORTB, PB0, 0, 0, 0, 0);
+	
+	_mpu9520_config = (spi_transaction_t){.spi = _spi_mpu9520, .len = 2, .clock_divider = MPU9520_CONFIG_CLOCK, .call_back = _mpu9250_config_done};
+	_mpu9520_config.status = SPI_TRANSACTION_DONE;
+	_mpu9520_read_sample = (spi_transaction_t){.spi = _spi_mpu9520, .tx = _mpu9520_sample_tx, .rx = _mpu9520_sample_rx, .len = sizeof _mpu9520_sample_tx,
+		.clock_divider = MPU9520_DATA_CLOCK, .call_back = _mpu9250_read_done};
+	_mpu9520_read_sample.status = SPI_TRANSACTION_DONE;
+	
+	_mpu9520_fifo_count = (spi_transaction_t){.spi = _spi_mpu9520, .tx = _mpu9520_fifo_count_tx, .rx = _mpu9520_fifo_count_rx, .len = sizeof _mpu9520_fifo_count_tx,
+		.clock_divider = MPU9520_DATA_CLOCK, .call_back = _mpu9250_fifo_count_done};
+	_mpu9520_fifo_count.status = SPI_TRANSACTION_DONE;
+	_mpu9520_fifo_read = (spi_transaction_t){.spi = _spi_mpu9520, .tx = _mpu9520_fifo_tx, .tx_len = sizeof _mpu9520_fifo_tx, .rx = _mpu9520_fifo_rx,
+		.clock_divider = MPU9520_DATA_CLOCK, .call_back = _mpu9250_fifo_read_done};
+	_mpu9520_fifo_read.status = SPI_TRANSACTION_DONE;
+	_mpu9520_fifo_reset = (spi_transaction_t){.spi = _spi_mpu9520, .tx = _mpu9520_fifo_reset_tx, .len = sizeof _mpu9520_fifo_reset_tx,
+		.clock_divider = MPU9520_CONFIG_CLOCK};
+	_mpu9520_fifo_reset.status = SPI_TRANSACTION_DONE;
+	buffer_init(&_imu_fifo_buffer, _imu_fifo_storage, sizeof _imu_fifo_storage);
+	_imu_load_calibration();
+	
+	// Data ready interrupt - rising edge
+	*(&MPU9250_INT_PORT_reg - 1) &= ~_BV(MPU9250_INT_PIN_bit); // set pin to input
+	EICRA |= _BV(MPU9250_INT_ISC1_bit) | _BV(MPU9250_INT_ISC0_bit);
+	EIMSK |= _BV(MPU9250_INT_bit);
+	
+	set_imu_sample_rate(MPU9520_DEFAULT_RATE_HZ);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Write all the configuration registers
+static void _mpu9250_configure() {
 	uint8_t _sreg = SREG;
 	cli();
-	float _tmp = ((float)_x_gyro)/GYRO_500_DPS_DIVIDER;
+	
+	if (_mpu9520_config.status == SPI_TRANSACTION_DONE) {
+		_mpu9520_config_index = 0;
+		_mpu9520_config.tx = _mpu9520_config_regs[0];
+		spi_queue_transaction(&_mpu9520_config);
+		} else {
+		// Start over when the write on the bus is done
+		_mpu9520_config_index = -1;
+	}
+	
 	SREG = _sreg;
-	return _tmp;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-float get_y_rotation() {
+// Called from ISR
+static void _mpu9250_config_done(spi_transaction_t *transaction) {
+	// New range in the sensor - the conversion follows
+	if (transaction->tx == _mpu9520_config_regs[MPU9520_GYRO_CONFIG_ROW]) {
+		_gyro_range = transaction->tx[1] >> 3;
+		_imu_update_offsets();
+		} else if (transaction->tx == _mpu9520_config_regs[MPU9520_ACCEL_CONFIG_ROW]) {
+		_acc_range = transaction->tx[1] >> 3;
+		_imu_update_offsets();
+	}
+	
+	if (++_mpu9520_config_index < (int8_t)MPU9520_NO_OF_CONFIG_REGS) {
+		transaction->tx = _mpu9520_config_regs[_mpu9520_config_index];
+		spi_queue_transaction(transaction);
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void set_imu_ranges(board_acc_range_t acc_range, board_gyro_range_t gyro_range) {
 	uint8_t _sreg = SREG;
 	cli();
-	float _tmp = ((float)_y_gyro)/GYRO_500_DPS_DIVIDER;
+	// FS_SEL is bit 4:3
+	_mpu9520_config_regs[MPU9520_ACCEL_CONFIG_ROW][1] = (acc_range & 0x03) << 3;
+	_mpu9520_config_regs[MPU9520_GYRO_CONFIG_ROW][1] = (gyro_range & 0x03) << 3;
 	SREG = _sreg;
-	return _tmp;
+	
+	_mpu9250_configure();
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-float get_z_rotation() {
+uint16_t set_imu_sample_rate(uint16_t rate_hz) {
+	uint8_t _dlpf = 1;
+	
+	if (rate_hz < MPU9520_INTERNAL_RATE_HZ / 256 + 1) {
+		rate_hz = MPU9520_INTERNAL_RATE_HZ / 256 + 1;
+		} else if (rate_hz > MPU9520_INTERNAL_RATE_HZ) {
+		rate_hz = MPU9520_INTERNAL_RATE_HZ;
+	}
+	
+	uint8_t _div = MPU9520_INTERNAL_RATE_HZ / rate_hz - 1;
+	rate_hz = MPU9520_INTERNAL_RATE_HZ / (1 + _div);
+	
+	while ((_dlpf <= sizeof _mpu9520_dlpf_min_rate / sizeof _mpu9520_dlpf_min_rate[0]) && (rate_hz < _mpu9520_dlpf_min_rate[_dlpf - 1])) {
+		_dlpf++;
+	}
+	
 	uint8_t _sreg = SREG;
 	cli();
-	float _tmp = ((float)_z_gyro)/GYRO_500_DPS_DIVIDER;
+	_mpu9520_config_regs[MPU9520_SMPLRT_DIV_ROW][1] = _div;
+	_mpu9520_config_regs[MPU9520_CONFIG_ROW][1] = CONFIG_FIFO_MODE_STOP | _dlpf;
+	_mpu9520_config_regs[MPU9520_ACCEL_CONFIG2_ROW][1] = _dlpf;
+	_mpu9520_sample_period_us = (1 + _div) * (1000000UL / MPU9520_INTERNAL_RATE_HZ);
+	// Read the FIFO count twice per watermark
+	_mpu9520_fifo_poll_ms = (MPU9520_FIFO_WATERMARK * (1 + _div)) / 2;
+	if (_mpu9520_fifo_poll_ms == 0) {
+		_mpu9520_fifo_poll_ms = 1;
+	}
 	SREG = _sreg;
-	return _tmp;
+	
+	_mpu9250_configure();
+	
+	return rate_hz;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-int16_t get_raw_x_rotation() {
+// Decode the big endian acc, temperature and gyro values
+static void _mpu9250_decode_sample(const uint8_t *values, uint32_t timestamp, imu_sample_t *sample) {
+	sample->timestamp = timestamp;
+	sample->acc_x = (values[0] << 8) | values[1];
+	sample->acc_y = (values[2] << 8) | values[3];
+	sample->acc_z = (values[4] << 8) | values[5];
+	sample->temperature = (values[6] << 8) | values[7];
+	sample->gyro_x = (values[8] << 8) | values[9];
+	sample->gyro_y = (values[10] << 8) | values[11];
+	sample->gyro_z = (values[12] << 8) | values[13];
+	// The ranges the values are read with, they may change before the sample is converted
+	sample->acc_range = _acc_range;
+	sample->gyro_range = _gyro_range;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Subtract an offset, saturated so a clipped value stays clipped
+static inline int16_t _imu_remove_offset(int16_t value, int16_t offset) {
+	int32_t _value = (int32_t)value - offset;
+	
+	if (_value > INT16_MAX) {
+		return INT16_MAX;
+		} else if (_value < INT16_MIN) {
+		return INT16_MIN;
+	}
+	
+	return _value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Scale the offsets to the current ranges - called from ISR or with interrupts disabled
+static void _imu_update_offsets() {
+	for (uint8_t i = 0; i < 3; i++) {
+		_acc_offset[i] = _imu_calibration.acc[i] >> _acc_range;
+		_gyro_offset[i] = _imu_calibration.gyro[i] >> _gyro_range;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static uint8_t _imu_calibration_checksum(const _imu_calibration_t *calibration) {
+	const uint8_t *_byte = (const uint8_t *)calibration;
+	uint8_t _sum = 0;
+	
+	for (uint8_t i = 0; i < offsetof(_imu_calibration_t, checksum); i++) {
+		_sum += _byte[i];
+	}
+	
+	return ~_sum;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Load the offsets from EEPROM - no offsets if they are not valid
+static void _imu_load_calibration() {
+	eeprom_read_block(&_imu_calibration, &_ee_imu_calibration, sizeof _imu_calibration);
+	
+	if ((_imu_calibration.magic != IMU_CALIBRATION_MAGIC) || (_imu_calibration.checksum != _imu_calibration_checksum(&_imu_calibration))) {
+		for (uint8_t i = 0; i < 3; i++) {
+			_imu_calibration.acc[i] = 0;
+			_imu_calibration.gyro[i] = 0;
+		}
+	}
+	
 	uint8_t _sreg = SREG;
 	cli();
-	int16_t _tmp = _x_gyro;
+	_imu_update_offsets();
 	SREG = _sreg;
-	return _tmp;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-int16_t get_raw_y_rotation() {
+// Samples left in the calibration - the 16 bit counter is decremented by the ISR
+static uint16_t _imu_calibration_remaining() {
 	uint8_t _sreg = SREG;
 	cli();
-	int16_t _tmp = _y_gyro;
+	uint16_t _tmp = _imu_calibration_samples;
 	SREG = _sreg;
 	return _tmp;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-int16_t get_raw_z_rotation() {
+uint8_t imu_calibrate(uint16_t no_of_samples) {
+	if (no_of_samples == 0) {
+		return 0;
+	}
+	
 	uint8_t _sreg = SREG;
 	cli();
-	int16_t _tmp = _z_gyro;
+	for (uint8_t i = 0; i < 3; i++) {
+		_acc_sum[i] = 0;
+		_gyro_sum[i] = 0;
+	}
+	_imu_calibration_samples = no_of_samples;
+	uint32_t _period_us = _mpu9520_sample_period_us;
 	SREG = _sreg;
-	return _tmp;
+	
+	// Twice the expected time, in steps of 10 ms - the period is whole ms, so divide first to stay inside 32 bits
+	uint32_t _timeout = (uint32_t)no_of_samples * (_period_us / 100) / 50 + 10;
+	while (_imu_calibration_remaining() && _timeout--) {
+		vTaskDelay(10 / portTICK_PERIOD_MS);
+	}
+	
+	// Stop a calibration that timed out, in the same critical section as the test
+	_sreg = SREG;
+	cli();
+	uint16_t _remaining = _imu_calibration_samples;
+	_imu_calibration_samples = 0;
+	SREG = _sreg;
+	if (_remaining) {
+		return 0;
+	}
+	
+	// Average in the 2 g and 250 degrees/s ranges - Z sees 1 g when the car is level
+	_imu_calibration_t _calibration;
+	_calibration.magic = IMU_CALIBRATION_MAGIC;
+	for (uint8_t i = 0; i < 3; i++) {
+		_calibration.acc[i] = (_acc_sum[i] / (int32_t)no_of_samples) << _acc_range;
+		_calibration.gyro[i] = (_gyro_sum[i] / (int32_t)no_of_samples) << _gyro_range;
+	}
+	_calibration.acc[2] -= ACC_1G_2G_RANGE;
+	_calibration.checksum = _imu_calibration_checksum(&_calibration);
+	
+	_sreg = SREG;
+	cli();
+	_imu_calibration = _calibration;
+	_imu_update_offsets();
+	SREG = _sreg;
+	
+	eeprom_update_block(&_calibration, &_ee_imu_calibration, sizeof _calibration);
+	
+	return 1;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-void _init_mpu9520() {
-	buffer_init(&_mpu9520_rx_buffer);
-	buffer_init(&_mpu9250_tx_buffer);
-	_spi_mpu9520 = spi_new_instance(SPI_MODE_MASTER, SPI_CLOCK_DIVIDER_128, 3, SPI_DATA_ORDER_MSB, &PORTB, PB0, 0,	&_mpu9520_rx_buffer, &_mpu9250_tx_buffer, &_mpu9250_call_back);
-	_mpu9250_call_back(0,0);
+// Called from ISR - number the sample and make it the newest
+static void _imu_publish(imu_sample_t *sample) {
+	int16_t *_acc = &sample->acc_x;
+	int16_t *_gyro = &sample->gyro_x;
+	
+	if (_imu_calibration_samples) {
+		for (uint8_t i = 0; i < 3; i++) {
+			_acc_sum[i] += _acc[i];
+			_gyro_sum[i] += _gyro[i];
+		}
+		_imu_calibration_samples--;
+	}
+	
+	for (uint8_t i = 0; i < 3; i++) {
+		_acc[i] = _imu_remove_offset(_acc[i], _acc_offset[i]);
+		_gyro[i] = _imu_remove_offset(_gyro[i], _gyro_offset[i]);
+	}
+	sample->sequence = ++_imu_sequence;
+	
+	_imu_seq++;
+	MEMORY_BARRIER();
+	_imu_sample = *sample;
+	MEMORY_BARRIER();
+	_imu_seq++;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-static void _mpu9250_write_2_reg(uint8_t reg, uint8_t value) {
-	uint8_t buf[2];
-	buf[0] = reg;
-	buf[1] = value;
-
-	spi_send_string(_spi_mpu9520, buf , 2);
+// Data ready from the MPU-9250
+ISR(MPU9250_INT_vect) {
+	// Skip if the last read is not done
+	if (_spi_mpu9520 && !_imu_fifo_task && (_mpu9520_read_sample.status == SPI_TRANSACTION_DONE)) {
+		_mpu9520_sample_time = _time_us();
+		spi_queue_transaction(&_mpu9520_read_sample);
+	}
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-static void _mpu9250_read_reg(uint8_t reg, uint8_t no_of_bytes)
+// Called from ISR
+static void _mpu9250_read_done(spi_transaction_t *transaction)
 {
-	uint8_t send[no_of_bytes+1];
-	send[0] = MPU9520_READ | reg;
-	for (uint8_t i = 1; i <= no_of_bytes; i++)
-	{
-		send[i] = 0;
-	}
+	// rx[0] is the command response
+	imu_sample_t _sample;
 	
-	buffer_clear(&_mpu9520_rx_buffer);
-	spi_send_string(_spi_mpu9520, send , no_of_bytes+1);
+	_mpu9250_decode_sample(transaction->rx + 1, _mpu9520_sample_time, &_sample);
+	_imu_publish(&_sample);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-static void _poll_acc() {
-	_mpu9250_read_reg(MPU9520_ACCEL_XOUT_H_REG ,6);
+void set_imu_fifo_mode(TaskHandle_t consumer_task) {
+	uint8_t _sreg = SREG;
+	cli();
+	_imu_fifo_task = consumer_task;
+	buffer_clear(&_imu_fifo_buffer);
+	if (consumer_task) {
+		_mpu9520_config_regs[MPU9520_FIFO_EN_ROW][1] = FIFO_EN_ACC_TEMP_GYRO;
+		_mpu9520_config_regs[MPU9520_FIFO_CTRL_ROW][1] = USER_CTRL_I2C_IF_DIS | USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RST;
+		_mpu9520_config_regs[MPU9520_INT_ENABLE_ROW][1] = 0;
+		} else {
+		_mpu9520_config_regs[MPU9520_FIFO_EN_ROW][1] = 0;
+		_mpu9520_config_regs[MPU9520_FIFO_CTRL_ROW][1] = USER_CTRL_I2C_IF_DIS;
+		_mpu9520_config_regs[MPU9520_INT_ENABLE_ROW][1] = INT_ENABLE_RAW_RDY_EN;
+	}
+	SREG = _sreg;
+	
+	_mpu9250_configure();
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-static void _poll_gyro() {
-	_mpu9250_read_reg(MPU9520_GYRO_XOUT_H_REG ,6);
-}
-// ----------------------------------------------------------------------------------------------------------------------
-static void _mpu9250_call_back(spi_p spi_instance, uint8_t spi_last_received_byte)
-{
-	uint8_t lsb, msb;
-	static _mpu9520_states_t state = _mpu9520_init_acc;
-
-	switch (state)
-	{
-		case _mpu9520_init_acc:
-		{
-			// Setup Acc
-			state = _mpu9520_init_gyro;
-			_mpu9250_write_2_reg(MPU9520_ACCEL_CONFIG_REG, ACC_FULL_SCALE_2_G);
-			break;
-		}
+uint16_t get_imu_samples(imu_sample_t *samples, uint16_t max_samples) {
+	uint16_t _no_of_samples = 0;
+	
+	while (_no_of_samples < max_samples) {
+		uint8_t _sreg = SREG;
+		cli();
+		uint8_t _result = buffer_get_items(&_imu_fifo_buffer, (uint8_t *)&samples[_no_of_samples], sizeof(imu_sample_t));
+		SREG = _sreg;
 		
-		case _mpu9520_init_gyro:
-		{
-			if (buffer_no_of_items(&_mpu9520_rx_buffer) == 2) {
-				// Setup Gyro
-				state = _mpu9520_poll_acc;
-				buffer_clear(&_mpu9520_rx_buffer);
-				_mpu9250_write_2_reg(MPU9520_GYRO_CONFIG_REG, GYRO_FULL_SCALE_500_DPS);
-			}
+		if (_result != BUFFER_OK) {
 			break;
 		}
+		_no_of_samples++;
+	}
+	
+	return _no_of_samples;
+}
 
-		case _mpu9520_poll_acc:
-		{
-			if (buffer_no_of_items(&_mpu9520_rx_buffer) == 2) {
-				state = _mpu9520_read_acc;
-				buffer_clear(&_mpu9520_rx_buffer);
-				_poll_acc();
-			}
-			break;
-		}
+// ----------------------------------------------------------------------------------------------------------------------
+// Called from ISR
+static void _mpu9250_fifo_poll() {
+	static uint16_t _count = 1;
+	
+	if (!_imu_fifo_task || (--_count != 0)) {
+		return;
+	}
+	_count = _mpu9520_fifo_poll_ms;
+	
+	// Skip if the last drain is not done
+	if ((_mpu9520_fifo_count.status == SPI_TRANSACTION_DONE) && (_mpu9520_fifo_read.status == SPI_TRANSACTION_DONE)) {
+		_mpu9520_fifo_time = _time_us();
+		spi_queue_transaction(&_mpu9520_fifo_count);
+	}
+}
 
-		case _mpu9520_read_acc:
-		{
-			if (buffer_no_of_items(&_mpu9520_rx_buffer) == 7) {
-				uint8_t _sreg = SREG;
-				cli();
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb); // Throw away the command response
-				buffer_get_item(&_mpu9520_rx_buffer, &msb);
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb);
-				_x_acc = (msb << 8) | lsb;
-				buffer_get_item(&_mpu9520_rx_buffer, &msb);
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb);
-				_y_acc = (msb << 8) | lsb;
-				buffer_get_item(&_mpu9520_rx_buffer, &msb);
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb);
-				SREG = _sreg;
-				_z_acc = (msb << 8) | lsb;
-				
-				state = _mpu9520_read_gyro;
-				_poll_gyro();
-			}
-			break;
+// ----------------------------------------------------------------------------------------------------------------------
+// Called from ISR
+static void _mpu9250_fifo_count_done(spi_transaction_t *transaction) {
+	uint8_t *_rx = transaction->rx;
+	uint16_t _bytes = ((_rx[1] & 0x1F) << 8) | _rx[2];
+	
+	// Full - samples are lost, start over to keep the sample alignment
+	if (_bytes >= MPU9520_FIFO_FULL) {
+		if (_mpu9520_fifo_reset.status == SPI_TRANSACTION_DONE) {
+			spi_queue_transaction(&_mpu9520_fifo_reset);
 		}
+		return;
+	}
+	
+	_mpu9520_fifo_samples = _bytes / MPU9520_SAMPLE_BYTES;
+	if (_mpu9520_fifo_samples < MPU9520_FIFO_WATERMARK) {
+		return;
+	}
+	
+	uint16_t _batch = (_mpu9520_fifo_samples > MPU9520_FIFO_MAX_BATCH) ? MPU9520_FIFO_MAX_BATCH : _mpu9520_fifo_samples;
+	_mpu9520_fifo_read.len = 1 + _batch * MPU9520_SAMPLE_BYTES;
+	spi_queue_transaction(&_mpu9520_fifo_read);
+}
 
-		case _mpu9520_read_gyro:
+// ----------------------------------------------------------------------------------------------------------------------
+// Called from ISR
+static void _mpu9250_fifo_read_done(spi_transaction_t *transaction) {
+	// rx[0] is the command response
+	uint8_t *_rx = transaction->rx + 1;
+	uint16_t _batch = (transaction->len - 1) / MPU9520_SAMPLE_BYTES;
+	imu_sample_t _sample;
+	// The newest sample in the FIFO is from about the time of the count read
+	uint32_t _time = _mpu9520_fifo_time - (uint32_t)(_mpu9520_fifo_samples - 1) * _mpu9520_sample_period_us;
+	
+	for (uint16_t i = 0; i < _batch; i++) {
+		_mpu9250_decode_sample(_rx, _time, &_sample);
+		_imu_publish(&_sample);
+		buffer_put_items(&_imu_fifo_buffer, (uint8_t *)&_sample, sizeof(imu_sample_t));
+		_rx += MPU9520_SAMPLE_BYTES;
+		_time += _mpu9520_sample_period_us;
+	}
+	
+	if (_imu_fifo_task) {
+		signed portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+		
+		vTaskNotifyGiveFromISR(_imu_fifo_task, &xHigherPriorityTaskWoken);
+		
+		if( xHigherPriorityTaskWoken != pdFALSE )
 		{
-			if (buffer_no_of_items(&_mpu9520_rx_buffer) == 7) {
-				uint8_t _sreg = SREG;
-				cli();
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb); // Throw away the command response
-				buffer_get_item(&_mpu9520_rx_buffer, &msb);
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb);
-				_x_gyro = (msb << 8) | lsb;
-				buffer_get_item(&_mpu9520_rx_buffer, &msb);
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb);
-				_y_gyro = (msb << 8) | lsb;
-				buffer_get_item(&_mpu9520_rx_buffer, &msb);
-				buffer_get_item(&_mpu9520_rx_buffer, &lsb);
-				SREG = _sreg;
-				_z_gyro = (msb << 8) | lsb;
-
-				state = _mpu9520_read_acc;
-				_poll_acc();
-			}
-			break;
+			taskYIELD();
 		}
-
-		default:
-		break;
 	}
 }
 
@@ -472,18 +1117,135 @@ uint16_t get_tacho_count() {
 	static uint16_t _last_reading = 0;
 	
 	uint16_t _tmp = TACHO_TCNT_reg;
-	uint16_t _tmp_last = _tmp;
+	// Unsigned subtraction handles the wrap around
+	uint16_t _count = _tmp - _last_reading;
+	_last_reading = _tmp;
 	
-	if (_tmp < _last_reading) {
-		_tmp = (UINT16_MAX - _last_reading + _tmp);
-		} else {
-		_tmp = _tmp-_last_reading;
+	return _count;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// 32 bit tacho count - called from ISR or task
+static uint32_t _tacho_total_count() {
+	uint8_t _sreg = SREG;
+	cli();
+	uint16_t _overflows = _tacho_overflows;
+	uint16_t _tcnt = TACHO_TCNT_reg;
+	
+	// Overflow not handled yet
+	if ((TACHO_TIFR_reg & _BV(TACHO_TOV_bit)) && (_tcnt < 0x8000)) {
+		_overflows++;
 	}
-	_last_reading = _tmp_last;
+	SREG = _sreg;
 	
+	return ((uint32_t)_overflows << 16) | _tcnt;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_tacho_total_count() {
+	return _tacho_total_count();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_lap_distance_mm() {
+	uint8_t _sreg = SREG;
+	cli();
+	uint32_t _start = _lap_start_count;
+	SREG = _sreg;
+	
+	return ((_tacho_total_count() - _start) * TACHO_UM_PER_PULSE) / 1000UL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_last_lap_distance_mm() {
+	uint8_t _sreg = SREG;
+	cli();
+	uint32_t _tmp = _last_lap_count;
+	SREG = _sreg;
+	
+	return (_tmp * TACHO_UM_PER_PULSE) / 1000UL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+ISR(TACHO_OVF_vect) {
+	_tacho_overflows++;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Speed from a tacho period, taking the time since the last edge into account
+static uint32_t _tacho_speed(uint32_t period_us) {
+	uint8_t _sreg = SREG;
+	cli();
+	uint32_t _last_edge_us = _tacho_last_edge_us;
+	SREG = _sreg;
+	
+	uint32_t _since_edge_us = _time_us() - _last_edge_us;
+	
+	if ((period_us == 0) || (_since_edge_us > TACHO_STOP_TIMEOUT_US)) {
+		return 0;
+	}
+	
+	// Slowing down - the period is at least the time since the last edge
+	if (_since_edge_us > period_us) {
+		period_us = _since_edge_us;
+	}
+	
+	return (TACHO_UM_PER_PULSE * 1000UL) / period_us;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_tacho_period_us() {
+	uint8_t _sreg = SREG;
+	cli();
+	uint32_t _tmp = _tacho_period_us;
+	SREG = _sreg;
 	return _tmp;
 }
 
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_speed() {
+	return _tacho_speed(get_tacho_period_us());
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_filtered_speed() {
+	uint8_t _sreg = SREG;
+	cli();
+	uint32_t _tmp = _tacho_filtered_period_us;
+	SREG = _sreg;
+	return _tacho_speed(_tmp);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Tacho edge - time it and wait for the next one
+ISR(TACHO_COMPA_vect) {
+	uint32_t _now_us = _time_us();
+	uint16_t _tcnt = TACHO_TCNT_reg;
+	uint16_t _edges = _tcnt - _tacho_last_tcnt;
+	
+	TACHO_OCRA_reg = _tcnt + 1;
+	_tacho_last_tcnt = _tcnt;
+	
+	// Edges may be missed while interrupts are disabled, the period is per edge
+	if (_edges && _tacho_have_edge && (_now_us - _tacho_last_edge_us < TACHO_STOP_TIMEOUT_US)) {
+		_tacho_period_us = _now_us - _tacho_last_edge_us;
+		if (_edges > 1) {
+			_tacho_period_us /= _edges;
+		}
+		if (_tacho_filtered_period_us == 0) {
+			_tacho_filtered_period_us = _tacho_period_us;
+			} else {
+			_tacho_filtered_period_us += ((int32_t)(_tacho_period_us - _tacho_filtered_period_us)) >> TACHO_FILTER_SHIFT;
+		}
+		} else {
+		// First edge since start or after a stop - nothing to time it from
+		_tacho_period_us = 0;
+		_tacho_filtered_period_us = 0;
+	}
+	_tacho_last_edge_us = _now_us;
+	_tacho_have_edge = 1;
+}
+
 // ----------------------------------------------------------------------------------------------------------------------
 void set_bt_reset(uint8_t state) {
 	if (state) {
@@ -499,10 +1261,15 @@ static void _send_bytes_to_bt(uint8_t *bytes, uint8_t len) {
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-uint8_t bt_send_bytes(uint8_t *bytes, uint8_t len) {
+uint8_t bt_send_bytes(uint8_t *bytes, uint16_t len) {
 	return serial_send_bytes(_bt_serial_instance, bytes, len);
 }
 
+// ----------------------------------------------------------------------------------------------------------------------
+uint8_t bt_send_bytes_blocking(uint8_t *bytes, uint16_t len, TickType_t timeout) {
+	return serial_send_bytes_blocking(_bt_serial_instance, bytes, len, timeout);
+}
+
 // ----------------------------------------------------------------------------------------------------------------------
 void _bt_status_call_back(uint8_t result) {
 	_bt_dialog_active = 0;
@@ -512,30 +1279,139 @@ void _bt_status_call_back(uint8_t result) {
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-void init_bt_module(void (*bt_status_call_back)(uint8_t result), QueueHandle_t RX_Que) {
-	_xRxedCharsQ = RX_Que;
+void init_bt_module(void (*bt_status_call_back)(uint8_t result), TaskHandle_t rx_task) {
+	_bt_rx_task = rx_task;
 	_app_bt_status_call_back = bt_status_call_back;
 	_bt_dialog_active = 1;
 	dialog_start(_dialog_bt_init_seq, _send_bytes_to_bt, _bt_status_call_back);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------
-static void _bt_call_back(serial_p _bt_serial_instance, uint8_t serial_last_received_byte) {
-	if (_bt_dialog_active) {
-		dialog_byte_received(serial_last_received_byte);
-		} else {
-		if (_xRxedCharsQ) {
-			signed portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+uint16_t bt_receive_bytes(uint8_t *bytes, uint16_t len) {
+	return serial_get_bytes(_bt_serial_instance, bytes, len);
+}
 
-			xQueueSendFromISR( _xRxedCharsQ, &serial_last_received_byte, &xHigherPriorityTaskWoken );
+// ----------------------------------------------------------------------------------------------------------------------
+// Called from ISR
+static void _bt_notify_rx_task() {
+	signed portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+	
+	_bt_rx_unnotified = 0;
+	vTaskNotifyGiveFromISR(_bt_rx_task, &xHigherPriorityTaskWoken);
 
-			if( xHigherPriorityTaskWoken != pdFALSE )
-			{
-				taskYIELD();
+	if( xHigherPriorityTaskWoken != pdFALSE )
+	{
+		taskYIELD();
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void _bt_call_back(serial_p _bt_serial_instance, uint8_t serial_last_received_byte) {
+	uint8_t _ch;
+	
+	if (_bt_dialog_active || !_bt_rx_task) {
+		// Drain the rx buffer so the flow control keeps CTS active
+		while (serial_get_byte(_bt_serial_instance, &_ch) == BUFFER_OK) {
+			if (_bt_dialog_active) {
+				dialog_byte_received(_ch);
 			}
 		}
+		return;
+	}
+
+	// Leave the bytes in the rx buffer and wake the rx task once per message,
+	// or once when the buffer crosses the notify level - not for every byte above it
+	if (buffer_no_of_items(&_bt_rx_buffer) >= BT_RX_NOTIFY_LEVEL) {
+		if (!_bt_rx_above_notify_level) {
+			_bt_rx_above_notify_level = 1;
+			_bt_notify_rx_task();
+			} else {
+			_bt_rx_unnotified = 1; // The rest is delivered at the end of the message
+		}
+		} else {
+		_bt_rx_above_notify_level = 0;
+		_bt_rx_unnotified = 1;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void _bt_frame_call_back(serial_p _bt_serial_instance, uint16_t no_of_bytes) {
+	if (_bt_rx_unnotified && _bt_rx_task && !_bt_dialog_active) {
+		_bt_notify_rx_task();
+	}
+}
+
+#if BUFFER_USE_STATISTICS == 1
+// ----------------------------------------------------------------------------------------------------------------------
+static buffer_struct_t *_board_buffer(board_buffer_t buffer_id) {
+	switch (buffer_id) {
+		case board_BT_RX_BUFFER:
+		return &_bt_rx_buffer;
+		case board_BT_TX_BUFFER:
+		return &_bt_tx_buffer;
+		case board_IMU_FIFO_BUFFER:
+		return &_imu_fifo_buffer;
+		default:
+		return NULL;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+void get_buffer_statistics(board_buffer_t buffer_id, buffer_statistics_t *stats) {
+	buffer_struct_t *_buffer = _board_buffer(buffer_id);
+	
+	if (_buffer) {
+		uint8_t _sreg = SREG;
+		cli();
+		buffer_get_statistics(_buffer, stats);
+		SREG = _sreg;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint8_t bt_send_buffer_statistics(board_buffer_t buffer_id) {
+	static const char *_names[] = {"BT_RX", "BT_TX", "IMU_FIFO"};
+	// Static to keep it off the stack of the calling task, the line is copied to the tx buffer before returning
+	static char _line[80];
+	buffer_statistics_t _stats;
+	
+	if (buffer_id > board_IMU_FIFO_BUFFER) {
+		return BUFFER_EMPTY;
+	}
+
+	get_buffer_statistics(buffer_id, &_stats);
+	int _len = snprintf(_line, sizeof _line, "%s peak:%u put:%lu get:%lu drop:%lu\r\n", _names[buffer_id],
+		_stats.peak, (unsigned long)_stats.puts, (unsigned long)_stats.gets, (unsigned long)_stats.dropped);
+	
+	return bt_send_bytes((uint8_t *)_line, _len);
+}
+#endif
+
+#if SPI_BENCHMARK == 1
+// ----------------------------------------------------------------------------------------------------------------------
+uint8_t bt_send_spi_benchmark(uint16_t count) {
+	// Static, a read that did not finish in time may still be on the bus when returning
+	static uint8_t _rx[MPU9520_SAMPLE_BYTES + 1];
+	static spi_transaction_t _read;
+	static char _line[80];
+	spi_benchmark_t _polled;
+	spi_benchmark_t _interrupt;
+	
+	if (_read.spi == 0) {
+		_read = (spi_transaction_t){.spi = _spi_mpu9520, .tx = _mpu9520_sample_tx, .rx = _rx, .len = sizeof _mpu9520_sample_tx,
+			.clock_divider = MPU9520_DATA_CLOCK, .status = SPI_TRANSACTION_DONE};
+	}
+	
+	if (spi_benchmark(&_read, count, get_time_us, &_polled, &_interrupt) != SPI_OK) {
+		return BUFFER_EMPTY;
 	}
+	
+	int _len = snprintf(_line, sizeof _line, "SPI polled:%lu B/s %u%% irq:%lu B/s %u%%\r\n", (unsigned long)_polled.bytes_per_s,
+		_polled.cpu_load_percent, (unsigned long)_interrupt.bytes_per_s, _interrupt.cpu_load_percent);
+	
+	return bt_send_bytes((uint8_t *)_line, _len);
 }
+#endif
 
 // ----------------------------------------------------------------------------------------------------------------------
 void set_goal_line_semaphore(SemaphoreHandle_t goal_line_semaphore) {
@@ -546,6 +1422,12 @@ void set_goal_line_semaphore(SemaphoreHandle_t goal_line_semaphore) {
 
 ISR(INT0_vect) {
 	static signed portBASE_TYPE _higher_priority_task_woken;
+	
+	// Latch the lap distance
+	uint32_t _count = _tacho_total_count();
+	_last_lap_count = _count - _lap_start_count;
+	_lap_start_count = _count;
+	
 	if (_goal_line_semaphore) {
 		_higher_priority_task_woken = pdFALSE;
 
@@ -560,27 +1442,75 @@ ISR(INT0_vect) {
 // ----------------------------------------------------------------------------------------------------------------------
 static void _init_dialog_handler_timer() {
 	DIALOG_HANDLER_OCRA_reg = DIALOG_HANDLER_TOP;
-	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_WGM1_bit); // CTC Mode
+	DIALOG_HANDLER_TCCRA_reg |= _BV(DIALOG_HANDLER_WGM1_bit); // CTC Mode - WGM21 is in TCCR2A, TCCR2B only holds WGM22 and the clock select
 	DIALOG_HANDLER_TIMSK_reg |= _BV(DIALOG_HANDLER_OCIEA_bit); // Enable Compare A interrupt
 	
+	// Timer 2 has its own prescaler selection
 	#if (DIALOG_HANDLER_PRESCALER == 1)
 	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS0_bit);    // Prescaler 1 and Start Timer
 	#elif ((DIALOG_HANDLER_PRESCALER == 8))
 	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS1_bit);    // Prescaler 8 and Start Timer
+	#elif ((DIALOG_HANDLER_PRESCALER == 32))
+	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS0_bit) | _BV(DIALOG_HANDLER_CS1_bit);    // Prescaler 32 and Start Timer
 	#elif ((DIALOG_HANDLER_PRESCALER == 64))
-	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS0_bit) | _BV(DIALOG_HANDLER_CS1_bit);    // Prescaler 64 and Start Timer
+	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS2_bit);    // Prescaler 64 and Start Timer
+	#elif ((DIALOG_HANDLER_PRESCALER == 128))
+	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS0_bit) | _BV(DIALOG_HANDLER_CS2_bit);    // Prescaler 128 and Start Timer
 	#elif ((DIALOG_HANDLER_PRESCALER == 256))
-	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS2_bit);    // Prescaler 256 and Start Timer
+	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS1_bit) | _BV(DIALOG_HANDLER_CS2_bit);    // Prescaler 256 and Start Timer
 	#elif ((DIALOG_HANDLER_PRESCALER == 1024))
-	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS0_bit) | _BV(DIALOG_HANDLER_CS2_bit); ;    // Prescaler 1024 and Start Timer
+	DIALOG_HANDLER_TCCRB_reg |= _BV(DIALOG_HANDLER_CS0_bit) | _BV(DIALOG_HANDLER_CS1_bit) | _BV(DIALOG_HANDLER_CS2_bit);    // Prescaler 1024 and Start Timer
 	#endif
 }
 
+// ----------------------------------------------------------------------------------------------------------------------
+// Microseconds from the dialog handler timer
+static uint32_t _time_us() {
+	static uint32_t _last_us = 0;
+	
+	uint8_t _sreg = SREG;
+	cli();
+	uint32_t _ms = _time_ms;
+	uint8_t _tcnt = DIALOG_HANDLER_TCNT_reg;
+	
+	// Compare match not handled yet (called with interrupts disabled) - the counter has restarted, so read it again
+	if (DIALOG_HANDLER_TIFR_reg & _BV(DIALOG_HANDLER_OCFA_bit)) {
+		_tcnt = DIALOG_HANDLER_TCNT_reg;
+		_ms++;
+	}
+	
+	uint32_t _us = _ms * 1000UL + _tcnt * DIALOG_HANDLER_US_PER_COUNT;
+	
+	// Never step back, can only happen if interrupts are disabled for more than 1 ms and a compare match is lost
+	if ((int32_t)(_us - _last_us) < 0) {
+		_us = _last_us;
+	}
+	_last_us = _us;
+	SREG = _sreg;
+	
+	return _us;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+uint32_t get_time_us() {
+	return _time_us();
+}
+
 ISR(TIMER2_COMPA_vect) {
-	static uint8_t _count = 10;
+	static uint8_t _count = 100;
+	
+	_time_ms++;
+	_mpu9250_fifo_poll();
+	serial_idle_tick();
+	
+	// Restart BT transmission paused by RTS
+	if (_bt_serial_instance) {
+		serial_resume_tx(_bt_serial_instance);
+	}
+	
 	if (_bt_dialog_active) {
 		if (--_count == 0) {
-			_count = 10;
+			_count = 100;
 			dialog_tick();
 		}
 	}
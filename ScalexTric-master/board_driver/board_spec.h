@@ -33,9 +33,21 @@
 #define BT_MASTER_PORT			PORTA
 #define BT_MASTER_PIN			PA2
 
+// Timer 4 (and 5) used by the serial driver for idle line detection
+
 // GOAL LINE + INT0 used
 
-// TACHO - Timer 1 used
+// MPU-9250 data ready - INT1 used, rising edge
+#define MPU9250_INT_PORT_reg	PORTD
+#define MPU9250_INT_PIN_bit		PD1
+#define MPU9250_INT_bit			INT1
+#define MPU9250_INT_ISC0_bit	ISC10
+#define MPU9250_INT_ISC1_bit	ISC11
+#define MPU9250_INT_vect		INT1_vect
+
+// TACHO - Timer 1 used, clocked by the tacho on T1 (PD6)
+// Distance the car moves per tacho pulse [um] - must be measured on the car
+#define TACHO_UM_PER_PULSE		1000UL
 #define TACHO_TCCRA_reg			TCCR1A
 #define TACHO_TCCRB_reg			TCCR1B
 #define TACHO_TCCRC_reg			TCCR1C
@@ -59,6 +71,11 @@
 #define TACHO_TIMSK_reg			TIMSK1
 #define TACHO_TIFR_reg			TIFR1
 #define TACHO_TCNT_reg			TCNT1
+#define TACHO_OCIEA_bit			OCIE1A
+#define TACHO_TOIE_bit			TOIE1
+#define TACHO_TOV_bit			TOV1
+#define TACHO_COMPA_vect		TIMER1_COMPA_vect
+#define TACHO_OVF_vect			TIMER1_OVF_vect
 
 // HORN
 #define HORN_PORT_reg					PORTC
@@ -99,13 +116,16 @@
 #define MOTOR_CONTROL_ICR_reg			ICR3
 #define MOTOR_CONTROL_TIMSK_reg			TIMSK3
 #define MOTOR_CONTROL_TIFR_reg			TIFR3
+#define MOTOR_CONTROL_TOIE_bit			TOIE3
+#define MOTOR_CONTROL_OVF_vect			TIMER3_OVF_vect
 
 #define MOTOR_CONTROL_OCA_PORT_reg		PORTE
 #define MOTOR_CONTROL_OCA_PIN_bit		PE3
 #define MOTOR_CONTROL_OCB_PORT_reg		PORTE
 #define MOTOR_CONTROL_OCB_PIN_bit		PE4
 
-// Timer 2 used for generating 100ms ticks for dialog handler in driver 
+// Timer 2 used for generating 100ms ticks for dialog handler in driver, 1ms ticks for time stamps
+#define DIALOG_HANDLER_TCNT_reg				TCNT2
 #define DIALOG_HANDLER_TCCRA_reg			TCCR2A
 #define DIALOG_HANDLER_TCCRB_reg			TCCR2B
 #define DIALOG_HANDLER_COMA0_bit			COM2A0
@@ -124,5 +144,6 @@
 #define DIALOG_HANDLER_TIFR_reg				TIFR2
 #define DIALOG_HANDLER_TOIE_bit				TOIE2
 #define DIALOG_HANDLER_OCIEA_bit			OCIE2A
+#define DIALOG_HANDLER_OCFA_bit				OCF2A
 
 #endif /* BOARD_SPEC_H_ */
\ No newline at end of file
@@ -9,9 +9,16 @@
   
   This is a simple implementation of a circular buffer that can hold uint8_t data.
   It is implemented as a FIFO.
-  The size of the buffer can be set in the header file @code buffer.h @endcode
-  @note Maximum size = 255.
+  Each buffer has its own size and storage, both given to buffer_init().
+  If the size is a power of two the indexes are wrapped with a mask, otherwise with a compare.
+  @note Maximum size = 65535.
   @note The functions are NOT protected against interrupts!
+
+  A buffer initialized with buffer_init_spsc() is in single-producer/single-consumer mode.
+  The producer only writes the in index and the consumer only writes the out index, there is no shared item counter.
+  An ISR and a task can therefore share the buffer without disabling interrupts, as long as only one of them puts
+  and only the other one gets.
+  @note A spsc buffer can hold size-1 items, and the size is limited to 256 so the index can be read in one go.
 	 
   @defgroup buffer_init Buffer Initialization
   @brief How to initialize the buffer.
@@ -22,14 +29,71 @@
  
   Here you you will find the functions you will need.
    
+  @defgroup buffer_bulk Buffer Bulk Functions
+  @brief Functions moving several items at the time.
+
+  The bulk functions copy with memcpy, and the span functions give direct access to the contiguous
+  part of the storage that can be read or written, so drivers and parsers can work in place.
+  A span is handed back with the matching commit function when it has been used.
+   
+  @defgroup buffer_statistics Buffer Statistics
+  @brief Fill level and traffic counters kept for each buffer.
+
+  When BUFFER_USE_STATISTICS is 1 (-DBUFFER_USE_STATISTICS=1, set in the Debug build) every buffer counts the items put, got and dropped
+  because the buffer was full, and remembers the highest fill level seen.
+  Use them to size the buffers from real traffic.
+   
   @defgroup buffer_return Buffer Return codes
   @brief Codes returned from buffer functions.
  @}
  */
 
+#include <string.h>
+
 #include "buffer.h"
 
-#define INCREMENT(x) ( (x+1) % BUFFER_SIZE ) /**< Increment % BUFFER_SIZE */
+/* Increment index and wrap around at size.
+ * Power of two sizes are masked - no division is involved in any case. */
+static inline uint16_t _increment(buffer_struct_t *buffer, uint16_t i) {
+	if (buffer->mask) {
+		return (i + 1) & buffer->mask;
+	}
+	return (++i == buffer->size) ? 0 : i;
+}
+
+/* Access to an index that is shared between producer and consumer in spsc mode */
+#define SHARED_INDEX(x) ( *(volatile uint16_t *)&(x) )
+
+/* Prevents the compiler from moving storage accesses past an index update */
+#define MEMORY_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/* Advance index n items and wrap around at size */
+static inline uint16_t _advance(buffer_struct_t *buffer, uint16_t i, uint16_t n) {
+	if (buffer->mask) {
+		return (i + n) & buffer->mask;
+	}
+	return (n >= buffer->size - i) ? n - (buffer->size - i) : i + n;
+}
+
+/* No of items between out and in */
+static inline uint16_t _spsc_count(buffer_struct_t *buffer, uint16_t in, uint16_t out) {
+	return (in >= out) ? in - out : buffer->size - out + in;
+}
+
+/* No of items in a spsc buffer */
+static inline uint16_t _spsc_no_of_items(buffer_struct_t *buffer) {
+	return _spsc_count(buffer, SHARED_INDEX(buffer->in_i), SHARED_INDEX(buffer->out_i));
+}
+
+/* Statistics - in spsc mode the producer owns puts, dropped and peak, the consumer owns gets */
+#if BUFFER_USE_STATISTICS == 1
+#define STATS_ADD(buffer, counter, n) ( (buffer)->stats.counter += (n) )
+#define STATS_PEAK(buffer, no_of_items) \
+	if ((no_of_items) > (buffer)->stats.peak) { (buffer)->stats.peak = (no_of_items); }
+#else
+#define STATS_ADD(buffer, counter, n)
+#define STATS_PEAK(buffer, no_of_items)
+#endif
 
 /********************************************//**
  @ingroup buffer_init
@@ -40,10 +104,11 @@
  Example:
  @code
  #include "buffer.h"
- // Declare a buffer structure to be used as receive buffer for SPI.
+ // Declare a buffer structure and its storage to be used as receive buffer for SPI.
  buffer_struct_t spi_rx_buffer;
+ uint8_t spi_rx_storage[32];
  // Initialize the buffer
- buffer_init(&spi_rx_buffer);
+ buffer_init(&spi_rx_buffer, spi_rx_storage, sizeof spi_rx_storage);
  
  // Now the buffer can be used
  // Put 7 into the buffer
@@ -51,12 +116,43 @@
   @endcode
 
  @note The buffer structure must be initialized before any of the buffer functions must be called.
+ @note Use a power of two size for the fastest index handling.
  @param *buffer Pointer to the buffer structure to be used.
+ @param *storage Pointer to the array holding the items - must be at least size bytes.
+ @param size Number of items the buffer can hold [1..65535].
  ***********************************************/
-void buffer_init(buffer_struct_t *buffer) {
+void buffer_init(buffer_struct_t *buffer, uint8_t *storage, uint16_t size) {
+	buffer->storage = storage;
+	buffer->size = size;
+	buffer->mask = BUFFER_IS_POWER_OF_2(size) ? size - 1 : 0;
 	buffer->in_i = 0;
 	buffer->out_i = 0;
 	buffer->no_in_buffer = 0;
+	buffer->spsc = 0;
+	#if BUFFER_USE_STATISTICS == 1
+	buffer_clear_statistics(buffer);
+	#endif
+}
+
+/********************************************//**
+ @ingroup buffer_init
+ @brief Buffer initialization in single-producer/single-consumer mode.
+
+ Initialize the buffer structure to be shared lock-free between one producer and one consumer,
+ typically an ISR and a task. None of them need to disable interrupts around the buffer functions.
+
+ @note Only one context may put and only one context may get items.
+ @note buffer_clear() must only be called while neither producer nor consumer is active.
+ @param *buffer Pointer to the buffer structure to be used.
+ @param *storage Pointer to the array holding the items - must be at least size bytes.
+ @param size Size of the storage [2..256], larger sizes are limited to 256. The buffer can hold size-1 items.
+ ***********************************************/
+void buffer_init_spsc(buffer_struct_t *buffer, uint8_t *storage, uint16_t size) {
+	if (size > BUFFER_SPSC_MAX_SIZE) {
+		size = BUFFER_SPSC_MAX_SIZE;
+	}
+	buffer_init(buffer, storage, size);
+	buffer->spsc = 1;
 }
 
 /********************************************//**
@@ -69,10 +165,23 @@ void buffer_init(buffer_struct_t *buffer) {
  @param *item pointer to the variable where the value of the item is returned.
  ***********************************************/
 uint8_t buffer_get_item(buffer_struct_t *buffer, uint8_t *item) {
+	if (buffer->spsc) {
+		uint16_t _out = buffer->out_i;
+		if (_out == SHARED_INDEX(buffer->in_i)) {
+			return BUFFER_EMPTY;
+		}
+		*item = buffer->storage[_out];
+		MEMORY_BARRIER();
+		SHARED_INDEX(buffer->out_i) = _increment(buffer, _out);
+		STATS_ADD(buffer, gets, 1);
+		return BUFFER_OK;
+	}
+
 	if (buffer->no_in_buffer > 0) {
 		*item = buffer->storage[buffer->out_i];
-		buffer->out_i = INCREMENT(buffer->out_i);
+		buffer->out_i = _increment(buffer, buffer->out_i);
 		buffer->no_in_buffer--;
+		STATS_ADD(buffer, gets, 1);
 		return BUFFER_OK;
 	}
 	return BUFFER_EMPTY;
@@ -88,12 +197,31 @@ uint8_t buffer_get_item(buffer_struct_t *buffer, uint8_t *item) {
  @param item to be stored in the buffer.
  ***********************************************/
 uint8_t buffer_put_item(buffer_struct_t *buffer, uint8_t item) {
-	if (buffer->no_in_buffer<BUFFER_SIZE) {
+	if (buffer->spsc) {
+		uint16_t _in = buffer->in_i;
+		uint16_t _next = _increment(buffer, _in);
+		uint16_t _out = SHARED_INDEX(buffer->out_i);
+		if (_next == _out) {
+			STATS_ADD(buffer, dropped, 1);
+			return BUFFER_FULL;
+		}
+		buffer->storage[_in] = item;
+		MEMORY_BARRIER();
+		SHARED_INDEX(buffer->in_i) = _next;
+		STATS_ADD(buffer, puts, 1);
+		STATS_PEAK(buffer, _spsc_count(buffer, _next, _out));
+		return BUFFER_OK;
+	}
+
+	if (buffer->no_in_buffer < buffer->size) {
 		buffer->storage[buffer->in_i] = item;
-		buffer->in_i = INCREMENT(buffer->in_i);
+		buffer->in_i = _increment(buffer, buffer->in_i);
 		buffer->no_in_buffer++;
+		STATS_ADD(buffer, puts, 1);
+		STATS_PEAK(buffer, buffer->no_in_buffer);
 		return BUFFER_OK;
 	}
+	STATS_ADD(buffer, dropped, 1);
 	return BUFFER_FULL;
 }
 
@@ -105,6 +233,9 @@ uint8_t buffer_put_item(buffer_struct_t *buffer, uint8_t item) {
  @param *buffer pointer to the buffer structure.
  ***********************************************/
 uint8_t buffer_is_empty(buffer_struct_t *buffer) {
+	if (buffer->spsc) {
+		return (SHARED_INDEX(buffer->in_i) == SHARED_INDEX(buffer->out_i));
+	}
 	return (buffer->no_in_buffer == 0);
 }
 
@@ -115,10 +246,27 @@ uint8_t buffer_is_empty(buffer_struct_t *buffer) {
  @return no of items in the buffer.
  @param *buffer pointer to the buffer structure.
  ***********************************************/
-uint8_t buffer_no_of_items(buffer_struct_t *buffer) {
+uint16_t buffer_no_of_items(buffer_struct_t *buffer) {
+	if (buffer->spsc) {
+		return _spsc_no_of_items(buffer);
+	}
 	return buffer->no_in_buffer;
 }
 
+/********************************************//**
+ @ingroup buffer_function
+ @brief Returns the no of free places in the buffer.
+
+ @return no of items that can be put into the buffer.
+ @param *buffer pointer to the buffer structure.
+ ***********************************************/
+uint16_t buffer_free_space(buffer_struct_t *buffer) {
+	if (buffer->spsc) {
+		return buffer->size - 1 - _spsc_no_of_items(buffer);
+	}
+	return buffer->size - buffer->no_in_buffer;
+}
+
 /**********************************************************************//**
  @ingroup buffer_function
  @brief Clear the content of the buffer.
@@ -129,4 +277,186 @@ void buffer_clear(buffer_struct_t *buffer) {
 	buffer->in_i = 0;
 	buffer->out_i = 0;
 	buffer->no_in_buffer = 0;
-}
\ No newline at end of file
+}
+
+/**********************************************************************//**
+ @ingroup buffer_bulk
+ @brief Put several items into the buffer.
+
+ Either all items are stored or none of them.
+
+ @return BUFFER_OK: all items stored in the buffer.\n
+    BUFFER_FULL: There is not room for all items, nothing is stored.
+ @param *buffer pointer to the buffer structure.
+ @param *items pointer to the items to be stored.
+ @param len no of items to store.
+ **********************************************************************/
+uint8_t buffer_put_items(buffer_struct_t *buffer, const uint8_t *items, uint16_t len) {
+	uint8_t *_span;
+	uint16_t _first;
+
+	if (len > buffer_free_space(buffer)) {
+		STATS_ADD(buffer, dropped, len);
+		return BUFFER_FULL;
+	}
+
+	_first = buffer_write_span(buffer, &_span);
+	if (_first > len) {
+		_first = len;
+	}
+	memcpy(_span, items, _first);
+	// The rest wraps around to the start of the storage
+	memcpy(buffer->storage, items + _first, len - _first);
+	buffer_write_commit(buffer, len);
+	return BUFFER_OK;
+}
+
+/**********************************************************************//**
+ @ingroup buffer_bulk
+ @brief Get several items from the buffer.
+
+ Either all items are removed or none of them.
+
+ @return BUFFER_OK: len items removed from buffer and returned in items.\n
+    BUFFER_EMPTY: There are less than len items in the buffer, items is not updated.
+ @param *buffer pointer to the buffer structure.
+ @param *items pointer to the array where the items are returned - must hold len items.
+ @param len no of items to get.
+ **********************************************************************/
+uint8_t buffer_get_items(buffer_struct_t *buffer, uint8_t *items, uint16_t len) {
+	uint8_t *_span;
+	uint16_t _first;
+
+	if (len > buffer_no_of_items(buffer)) {
+		return BUFFER_EMPTY;
+	}
+
+	_first = buffer_read_span(buffer, &_span);
+	if (_first > len) {
+		_first = len;
+	}
+	memcpy(items, _span, _first);
+	// The rest wraps around from the start of the storage
+	memcpy(items + _first, buffer->storage, len - _first);
+	buffer_read_commit(buffer, len);
+	return BUFFER_OK;
+}
+
+/**********************************************************************//**
+ @ingroup buffer_bulk
+ @brief Get the contiguous part of the buffer that can be read.
+
+ The items are left in the buffer until buffer_read_commit() is called.
+
+ Example:
+ @code
+ uint8_t *span;
+ uint16_t len = buffer_read_span(&rx_buffer, &span);
+ parse(span, len);
+ buffer_read_commit(&rx_buffer, len);
+ @endcode
+
+ @return no of items that can be read from span. The buffer can hold more items after a wrap around.
+ @param *buffer pointer to the buffer structure.
+ @param **span pointer to where the pointer to the first item is returned.
+ **********************************************************************/
+uint16_t buffer_read_span(buffer_struct_t *buffer, uint8_t **span) {
+	uint16_t _out = buffer->out_i;
+	uint16_t _len = buffer_no_of_items(buffer);
+
+	if (_len > buffer->size - _out) {
+		_len = buffer->size - _out;
+	}
+	*span = &buffer->storage[_out];
+	return _len;
+}
+
+/**********************************************************************//**
+ @ingroup buffer_bulk
+ @brief Remove items read through buffer_read_span() from the buffer.
+
+ @param *buffer pointer to the buffer structure.
+ @param len no of items to remove - must not exceed the length returned by buffer_read_span().
+ **********************************************************************/
+void buffer_read_commit(buffer_struct_t *buffer, uint16_t len) {
+	uint16_t _out = _advance(buffer, buffer->out_i, len);
+
+	if (buffer->spsc) {
+		MEMORY_BARRIER();
+		SHARED_INDEX(buffer->out_i) = _out;
+	} else {
+		buffer->out_i = _out;
+		buffer->no_in_buffer -= len;
+	}
+	STATS_ADD(buffer, gets, len);
+}
+
+/**********************************************************************//**
+ @ingroup buffer_bulk
+ @brief Get the contiguous part of the buffer that can be written.
+
+ The items written are not in the buffer until buffer_write_commit() is called.
+
+ @return no of items that can be written to span. The buffer can have more room after a wrap around.
+ @param *buffer pointer to the buffer structure.
+ @param **span pointer to where the pointer to the first free place is returned.
+ **********************************************************************/
+uint16_t buffer_write_span(buffer_struct_t *buffer, uint8_t **span) {
+	uint16_t _in = buffer->in_i;
+	uint16_t _len = buffer_free_space(buffer);
+
+	if (_len > buffer->size - _in) {
+		_len = buffer->size - _in;
+	}
+	*span = &buffer->storage[_in];
+	return _len;
+}
+
+/**********************************************************************//**
+ @ingroup buffer_bulk
+ @brief Add items written through buffer_write_span() to the buffer.
+
+ @param *buffer pointer to the buffer structure.
+ @param len no of items to add - must not exceed the length returned by buffer_write_span().
+ **********************************************************************/
+void buffer_write_commit(buffer_struct_t *buffer, uint16_t len) {
+	uint16_t _in = _advance(buffer, buffer->in_i, len);
+
+	if (buffer->spsc) {
+		MEMORY_BARRIER();
+		SHARED_INDEX(buffer->in_i) = _in;
+	} else {
+		buffer->in_i = _in;
+		buffer->no_in_buffer += len;
+	}
+	STATS_ADD(buffer, puts, len);
+	STATS_PEAK(buffer, buffer_no_of_items(buffer));
+}
+
+#if BUFFER_USE_STATISTICS == 1
+/**********************************************************************//**
+ @ingroup buffer_statistics
+ @brief Get a copy of the statistics of the buffer.
+
+ @note The copy is not protected against interrupts. Disable interrupts around the call if the
+ buffer is used from an ISR.
+ @param *buffer pointer to the buffer structure.
+ @param *stats pointer to where the statistics are copied.
+ **********************************************************************/
+void buffer_get_statistics(buffer_struct_t *buffer, buffer_statistics_t *stats) {
+	*stats = buffer->stats;
+}
+
+/**********************************************************************//**
+ @ingroup buffer_statistics
+ @brief Reset the statistics of the buffer.
+
+ @param *buffer pointer to the buffer structure.
+ **********************************************************************/
+void buffer_clear_statistics(buffer_struct_t *buffer) {
+	buffer->stats.peak = 0;
+	buffer->stats.puts = 0;
+	buffer->stats.gets = 0;
+	buffer->stats.dropped = 0;
+}
+#endif
\ No newline at end of file
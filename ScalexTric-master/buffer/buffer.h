@@ -12,8 +12,14 @@
 
 #include <stdint.h>
 
-// Max size 255
-#define BUFFER_SIZE 16
+// Max size 65535 - use a power of two to get mask indexing
+#define BUFFER_IS_POWER_OF_2(size) ( ((size) != 0) && (((size) & ((size) - 1)) == 0) )
+// Max size of a single-producer/single-consumer buffer - keeps the index high byte constant
+#define BUFFER_SPSC_MAX_SIZE 256
+// Set to 1 if every buffer should keep statistics - off by default, the Debug build turns it on
+#ifndef BUFFER_USE_STATISTICS
+#define BUFFER_USE_STATISTICS 0
+#endif
 
 /**
    @ingroup buffer_return
@@ -26,18 +32,47 @@
    @}
  */ 
 
+/**
+   @ingroup buffer_statistics
+   @brief Statistics kept for each buffer.
+ */
+typedef struct buffer_statistics {
+	uint16_t peak; /**< max no of items that has been in the buffer */
+	uint32_t puts; /**< no of items put into the buffer */
+	uint32_t gets; /**< no of items got from the buffer */
+	uint32_t dropped; /**< no of items not stored because the buffer was full */
+} buffer_statistics_t;
+
 typedef struct buffer_struct {
-	uint8_t storage[BUFFER_SIZE];
-	uint8_t in_i;
-	uint8_t out_i;
-	uint8_t no_in_buffer;
+	uint8_t *storage;
+	uint16_t size;
+	uint16_t mask; /**< size-1 when size is a power of two, otherwise 0 */
+	uint16_t in_i;
+	uint16_t out_i;
+	uint16_t no_in_buffer; /**< not used in spsc mode */
+	uint8_t spsc; /**< true if the buffer is in single-producer/single-consumer mode */
+	#if BUFFER_USE_STATISTICS == 1
+	buffer_statistics_t stats;
+	#endif
 } buffer_struct_t;
 
-void buffer_init(buffer_struct_t *buffer);
+void buffer_init(buffer_struct_t *buffer, uint8_t *storage, uint16_t size);
+void buffer_init_spsc(buffer_struct_t *buffer, uint8_t *storage, uint16_t size);
 uint8_t buffer_get_item(buffer_struct_t *buffer, uint8_t *item);
 uint8_t buffer_put_item(buffer_struct_t *buffer, uint8_t item);
 uint8_t buffer_is_empty(buffer_struct_t *buffer);
-uint8_t buffer_no_of_items(buffer_struct_t *buffer);
+uint16_t buffer_no_of_items(buffer_struct_t *buffer);
+uint16_t buffer_free_space(buffer_struct_t *buffer);
 void buffer_clear(buffer_struct_t *buffer);
+uint8_t buffer_put_items(buffer_struct_t *buffer, const uint8_t *items, uint16_t len);
+uint8_t buffer_get_items(buffer_struct_t *buffer, uint8_t *items, uint16_t len);
+uint16_t buffer_read_span(buffer_struct_t *buffer, uint8_t **span);
+void buffer_read_commit(buffer_struct_t *buffer, uint16_t len);
+uint16_t buffer_write_span(buffer_struct_t *buffer, uint8_t **span);
+void buffer_write_commit(buffer_struct_t *buffer, uint16_t len);
+#if BUFFER_USE_STATISTICS == 1
+void buffer_get_statistics(buffer_struct_t *buffer, buffer_statistics_t *stats);
+void buffer_clear_statistics(buffer_struct_t *buffer);
+#endif
 
 #endif /* BUFFER_H_ */
\ No newline at end of file
@@ -34,8 +34,76 @@ Here you you will find the functions you will need.
 #include "../FreeRTOS/Source/include/FreeRTOS.h"
 #include "../FreeRTOS/Source/include/semphr.h"
 #include "../FreeRTOS/Source/include/queue.h"
+#include "../FreeRTOS/Source/include/task.h"
 
 #include "../dialog_handler/dialog_handler.h"
+#include "../buffer/buffer.h"
+#include "../spi/spi_config.h"
+
+/**
+@ingroup board_return
+@{
+	@brief The function succeeded. */
+	#define BOARD_OK 0
+	/** @brief The Blue tooth serial port could not be set up at the baud rate. */
+	#define BOARD_BT_INIT_FAILED 1
+	/**
+@}
+*/
+
+/**
+@ingroup board_public
+@brief The buffers used by the Board Driver.
+*/
+typedef enum {
+	board_BT_RX_BUFFER = 0,
+	board_BT_TX_BUFFER,
+	board_IMU_FIFO_BUFFER
+} board_buffer_t;
+
+/**
+@ingroup board_public
+@brief Full scale ranges of the accelerometer.
+*/
+typedef enum {
+	board_ACC_RANGE_2G = 0, /**< +/-2 g. */
+	board_ACC_RANGE_4G, /**< +/-4 g. */
+	board_ACC_RANGE_8G, /**< +/-8 g. */
+	board_ACC_RANGE_16G /**< +/-16 g. */
+} board_acc_range_t;
+
+/**
+@ingroup board_public
+@brief Full scale ranges of the gyro.
+*/
+typedef enum {
+	board_GYRO_RANGE_250_DPS = 0, /**< +/-250 degrees/s. */
+	board_GYRO_RANGE_500_DPS, /**< +/-500 degrees/s. */
+	board_GYRO_RANGE_1000_DPS, /**< +/-1000 degrees/s. */
+	board_GYRO_RANGE_2000_DPS /**< +/-2000 degrees/s. */
+} board_gyro_range_t;
+
+/**
+@ingroup board_public
+@brief One sample from the MPU-9250, all axes read in the same SPI burst.
+
+The values are the sensor values in the full scale ranges the sample was read with, offset-corrected
+with the calibration from imu_calibrate() (the temperature is not corrected).
+The ranges are stored in the sample, so it can be converted with imu_raw_to_mg() and imu_raw_to_cdps() after a range change.
+*/
+typedef struct {
+	uint32_t timestamp; /**< time of the data ready interrupt [us], wraps after ~71 minutes. */
+	uint32_t sequence; /**< no of the sample, counts one per sample read - a gap means lost samples. */
+	int16_t acc_x; /**< offset-corrected X-acceleration. */
+	int16_t acc_y; /**< offset-corrected Y-acceleration. */
+	int16_t acc_z; /**< offset-corrected Z-acceleration. */
+	int16_t temperature; /**< raw die temperature, [degrees C] = temperature/333.87 + 21. */
+	int16_t gyro_x; /**< offset-corrected X-rotation. */
+	int16_t gyro_y; /**< offset-corrected Y-rotation. */
+	int16_t gyro_z; /**< offset-corrected Z-rotation. */
+	uint8_t acc_range; /**< board_acc_range_t of the acceleration values. */
+	uint8_t gyro_range; /**< board_gyro_range_t of the rotation values. */
+} imu_sample_t;
 
 //-------------------------------------------------
 /** 
@@ -43,8 +111,11 @@ Here you you will find the functions you will need.
 @brief Board Driver initialization.
 
 Initializes the Board Drivers.
+
+@return BOARD_OK: all drivers are initialized.\n
+	BOARD_BT_INIT_FAILED: the Blue tooth serial port could not be set up, the bt_xx functions must not be used.
 */
-void init_main_board();
+uint8_t init_main_board();
 
 /**
 @ingroup board_public_function
@@ -78,6 +149,7 @@ void set_brake_light(uint8_t state);
 @brief Set speed of the Car Motor.
 
 @note The motor will not be able to start for speed percents lower than ~50%.
+@note The motor output ramps to the new speed, see set_motor_ramp().
 
 @param[in] speed_percent [0 ... 100].
 */
@@ -88,33 +160,280 @@ void set_motor_speed(uint8_t speed_percent);
 @ingroup board_public_function
 @brief Set brake intensity of the Car Motor.
 
+@note The motor output ramps to the new brake intensity, see set_motor_ramp().
+
 @param[in] brake_percent [0 ... 100].
 */
 void set_brake(uint8_t brake_percent);
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Set speed of the Car Motor with per mille resolution.
+
+The compare value is looked up in a table in flash, so it is cheap enough to call from a fast control loop.
+
+@note The motor will not be able to start for speeds lower than ~500 per mille.
+
+@param[in] speed_permille [0 ... 1000].
+*/
+void set_motor_speed_permille(uint16_t speed_permille);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Set brake intensity of the Car Motor with per mille resolution.
+
+@param[in] brake_permille [0 ... 1000].
+*/
+void set_brake_permille(uint16_t brake_permille);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Set the ramps of the motor output.
+
+The motor output goes from full brake (-1000) over free run (0) to full speed (1000) per mille.
+Speed and brake changes are applied by the motor timer interrupt, one step per PWM period, until the output
+reaches the target, no task is involved.
+Ramping up (more speed or less brake) uses the acceleration rate, ramping down (less speed or more brake)
+uses the brake rate.
+
+The default is full speed in 0.5 s and full brake in 0.2 s.
+
+@param[in] accel_permille_per_s max change of the output ramping up [per mille/s], 0: no ramp.
+@param[in] brake_permille_per_s max change of the output ramping down [per mille/s], 0: no ramp.
+*/
+void set_motor_ramp(uint16_t accel_permille_per_s, uint16_t brake_permille_per_s);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the actual motor output while it ramps to the target.
+
+@return Output [per mille], 1 ... 1000: speed, 0: free run, -1 ... -1000: brake.
+*/
+int16_t get_motor_output_permille();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Set the full scale ranges of the IMU.
+
+The sensor is reprogrammed between two sample reads, and the fixed point and float getters follow the new ranges
+from the sample after. Default is +/-2 g and +/-500 degrees/s.
+
+@note In FIFO mode the samples in the FIFO are thrown away.
+
+@param[in] acc_range accelerometer range.
+@param[in] gyro_range gyro range.
+*/
+void set_imu_ranges(board_acc_range_t acc_range, board_gyro_range_t gyro_range);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Calibrate the bias of the IMU.
+
+Averages no_of_samples samples and stores the result as offsets in EEPROM. The offsets are subtracted from all
+later samples, and are loaded from EEPROM by init_main_board().
+
+@note The car must stand still and level while calibrating - the Z axis must see 1 g, X and Y 0 g.
+@note Blocks the calling task while sampling and writing the EEPROM, must be called from a task.
+
+@param[in] no_of_samples no of samples to average, e.g. 1000.
+
+@return 1: calibrated and saved, 0: no samples received.
+*/
+uint8_t imu_calibrate(uint16_t no_of_samples);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Set the sample rate of the IMU.
+
+The MPU-9250 generates a data ready interrupt at this rate, and each interrupt reads one sample.
+The digital low pass filter of the sensor is set to a bandwidth below half the sample rate.
+Default rate is 1000 Hz.
+
+@note The rate is made from 1000 Hz/n, e.g. 1000, 500, 333, 250, 200 or 100 Hz.
+
+@param[in] rate_hz wanted sample rate [4 ... 1000 Hz].
+
+@return the actual sample rate [Hz].
+*/
+uint16_t set_imu_sample_rate(uint16_t rate_hz);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Switch the IMU between data ready mode and FIFO mode.
+
+In FIFO mode the MPU-9250 stores the samples in its internal FIFO, and the driver reads them in bursts when
+8 samples or more are waiting. The samples are put in a ring and the consumer task is notified with
+xTaskNotifyGive() for each batch. The task reads them with get_imu_samples().
+
+The timestamps of the samples are made from the sample rate and the time the FIFO was checked.
+
+@note If the FIFO gets full it is reset, and the samples in it are lost.
+@note Samples are dropped if the ring is full, see get_buffer_statistics(board_IMU_FIFO_BUFFER, ...).
+
+@param[in] consumer_task handle to the task that reads the samples, NULL: data ready mode.
+*/
+void set_imu_fifo_mode(TaskHandle_t consumer_task);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get samples read in FIFO mode.
+
+Example:
+@code
+imu_sample_t samples[8];
+
+for (;;) {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	while ((n = get_imu_samples(samples, 8)) > 0) {
+		// use n samples
+	}
+}
+@endcode
+
+@param[out] *samples array where the samples are copied, oldest first.
+@param[in] max_samples size of the samples array.
+
+@return no of samples copied.
+*/
+uint16_t get_imu_samples(imu_sample_t *samples, uint16_t max_samples);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest IMU sample.
+
+Acceleration, temperature and rotation are from the same instant.
+
+The sample is copied without disabling interrupts, the copy is retried if a new sample arrives while copying.
+Two calls returning the same sequence number got the same sample.
+
+@note Must not be called from an ISR.
+
+@param[out] *sample pointer to where the sample is copied.
+*/
+void get_imu_sample(imu_sample_t *sample);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Convert a raw acceleration to milli-g.
+
+Uses an integer multiply and shift.
+
+@param[in] raw raw acceleration.
+@param[in] range full scale range the value was read with, acc_range of imu_sample_t.
+
+@return acceleration [mg].
+*/
+int16_t imu_raw_to_mg(int16_t raw, board_acc_range_t range);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Convert a raw rotation to centi-degrees per second.
+
+Uses an integer multiply and shift.
+
+@param[in] raw raw rotation.
+@param[in] range full scale range the value was read with, gyro_range of imu_sample_t.
+
+@return rotation [centi-degrees/s].
+*/
+int32_t imu_raw_to_cdps(int16_t raw, board_gyro_range_t range);
+
+/**
+@ingroup board_public_function
+@brief Set to 1 to include bt_send_imu_conversion_benchmark().
+*/
+#ifndef IMU_CONVERSION_BENCHMARK
+#define IMU_CONVERSION_BENCHMARK 0
+#endif
+
+#if IMU_CONVERSION_BENCHMARK == 1
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Measure the CPU cycles of the IMU unit conversions and send them to Bluetooth as a text line.
+
+Each conversion is run 1000 times between two get_time_us(), and an empty loop is subtracted.
+The line has the format "IMU cycles mg:<n> cdps:<n> float:<n> div:<n>\r\n" with the cycles per call of
+imu_raw_to_mg(), imu_raw_to_cdps(), imu_raw_to_mg() * 0.001f as in get_x_accel() and raw / 16384.0f, the
+software float divide the float getters used to do.
+
+@note Only included when IMU_CONVERSION_BENCHMARK is 1.
+@note Must be called from the task with the highest priority. The ISRs that run meanwhile are counted as well.
+@note The line is formatted in a static buffer, so it must only be called from one task.
+
+@return Buffer status [BUFFER_OK, BUFFER_FULL].
+*/
+uint8_t bt_send_imu_conversion_benchmark(void);
+#endif
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest X acceleration in fixed point.
+
+@return X-Acceleration [mg].
+*/
+int16_t get_x_accel_mg();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
 @brief Get newest X acceleration.
 
+@note Made from get_x_accel_mg(), use that if float is not needed.
+
 @return X-Acceleration [g].
 */
 float get_x_accel();
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest Y acceleration in fixed point.
+
+@return Y-Acceleration [mg].
+*/
+int16_t get_y_accel_mg();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
 @brief Get newest Y acceleration.
 
+@note Made from get_y_accel_mg(), use that if float is not needed.
+
 @return Y-Acceleration [g].
 */
 float get_y_accel();
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest Z acceleration in fixed point.
+
+@return Z-Acceleration [mg].
+*/
+int16_t get_z_accel_mg();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
 @brief Get newest Z acceleration.
 
+@note Made from get_z_accel_mg(), use that if float is not needed.
+
 @return Z-Acceleration [g].
 */
 float get_z_accel();
@@ -146,29 +465,62 @@ int16_t get_raw_y_accel();
 */
 int16_t get_raw_z_accel();
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest X rotation in fixed point.
+
+@return X-rotation [centi-degrees/s].
+*/
+int32_t get_x_rotation_cdps();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
 @brief Get newest X rotation.
 
+@note Made from get_x_rotation_cdps(), use that if float is not needed.
+
 @return X-rotation [degrees/s].
 */
 float get_x_rotation();
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest Y rotation in fixed point.
+
+@return Y-rotation [centi-degrees/s].
+*/
+int32_t get_y_rotation_cdps();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
 @brief Get newest Y rotation.
 
+@note Made from get_y_rotation_cdps(), use that if float is not needed.
+
 @return Y-rotation [degrees/s].
 */
 float get_y_rotation();
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get newest Z rotation in fixed point.
+
+@return Z-rotation [centi-degrees/s].
+*/
+int32_t get_z_rotation_cdps();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
 @brief Get newest Z rotation.
 
+@note Made from get_z_rotation_cdps(), use that if float is not needed.
+
 @return Z-rotation [degrees/s].
 */
 float get_z_rotation();
@@ -200,6 +552,85 @@ int16_t get_raw_y_rotation();
 */
 int16_t get_raw_z_rotation();
 
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the time between the last two tacho pulses.
+
+Each tacho pulse is timed in an interrupt with 4 us resolution.
+
+@return Period [us], 0: the car is standing still.
+*/
+uint32_t get_tacho_period_us();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the speed of the car from the period between the last two tacho pulses.
+
+When the car slows down, the time since the last pulse is used if it is longer than the last period.
+The speed is 0 when no pulse is seen in 0.5 s.
+
+@note The distance per pulse is TACHO_UM_PER_PULSE in board_spec.h.
+
+@return Speed [mm/s].
+*/
+uint32_t get_speed();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the filtered speed of the car.
+
+As get_speed(), but from the period low pass filtered over ~8 pulses.
+
+@return Speed [mm/s].
+*/
+uint32_t get_filtered_speed();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the total no of tacho pulses since start.
+
+The count is shared, any no of tasks can read it without affecting each other.
+
+@return Tacho pulses since init_main_board(), wraps at 2^32.
+*/
+uint32_t get_tacho_total_count();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the distance driven since the goal line was passed.
+
+@return Distance in the current lap [mm].
+*/
+uint32_t get_lap_distance_mm();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the distance of the last complete lap.
+
+Latched when the goal line is passed.
+
+@return Distance of the last lap [mm], after the first pass the distance from start to the goal line, 0: not passed yet.
+*/
+uint32_t get_last_lap_distance_mm();
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the time since init_main_board().
+
+The time is read from the 1 kHz system timer with 4 us resolution, it can be used to measure task timing.
+The time never steps back, also when it is read with interrupts disabled.
+
+@return Time [us], wraps after ~71 minutes.
+*/
+uint32_t get_time_us();
+
 //-------------------------------------------------
 /**
 @ingroup board_public_function
@@ -208,6 +639,7 @@ int16_t get_raw_z_rotation();
 		
 @note	If the counter counts more than 65535 pulses
 		between calls of this function, the result will be wrong.	
+@note	Only one task can use this function, use get_tacho_total_count() for more users.
 
 @return Tacho counts since last call [0-65535].
 */
@@ -235,7 +667,9 @@ void set_bt_reset(uint8_t state);
 The result of the initialisation can be: DIALOG_OK_STOP when every thing is OK, or DIALOG_ERROR_STOP if the Bluetooth module is not initialised correctly.
 
 @param[in] *bt_status_call_back pointer to a function that will be called when the initialisation is done - the result of the initialisation is given as parameter to the function.
-@param[in] RX_Que FreeRTOS Queue where bytes received from the Bluetooth module will be put.
+@param[in] rx_task FreeRTOS task that is notified when bytes are received from the Bluetooth module, NULL if received bytes should be thrown away.
+The task is notified once per message, when the line has been idle for 30 bit times, or when the receive buffer is half full.
+It should wait with ulTaskNotifyTake() and read the bytes with bt_receive_bytes().
 
 The  call back function must have this signature:
 @code
@@ -244,7 +678,33 @@ void foo(uint8_t)
 
 @note Baudrate for Bluetooth communication is 57.2K
 */
-void init_bt_module(void (*bt_status_call_back)(uint8_t result), QueueHandle_t RX_Que) ;
+void init_bt_module(void (*bt_status_call_back)(uint8_t result), TaskHandle_t rx_task) ;
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get bytes received from Bluetooth.
+
+Example:
+@code
+uint8_t buf[32];
+for (;;) {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	uint16_t len;
+	while ((len = bt_receive_bytes(buf, sizeof buf)) > 0) {
+		parse(buf, len);
+	}
+}
+@endcode
+
+@note Must only be called from the rx task given to init_bt_module().
+
+@param[out] bytes pointer to where the bytes are returned.
+@param[in] len max number of bytes to get.
+
+@return number of bytes returned [0 ... len].
+*/
+uint16_t bt_receive_bytes(uint8_t *bytes, uint16_t len);
 
 //-------------------------------------------------
 /**
@@ -258,7 +718,78 @@ void init_bt_module(void (*bt_status_call_back)(uint8_t result), QueueHandle_t R
 
 @return Buffer status [BUFFER_OK, BUFFER_EMPTY, BUFFER_FULL].
 */
-uint8_t bt_send_bytes(uint8_t *bytes, uint8_t len);
+uint8_t bt_send_bytes(uint8_t *bytes, uint16_t len);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Send a byte array of any length to Bluetooth.
+
+The calling task is blocked while the transmit buffer is full.
+
+@note The Bluetooth module must be initialised before sending.
+@note Must be called from a FreeRTOS task, and only from one task.
+
+@param[in] bytes pointer to byte array.
+@param[in] len number of bytes to send.
+@param[in] timeout max number of ticks to wait.
+
+@return Buffer status [BUFFER_OK, BUFFER_FULL] - BUFFER_FULL when the timeout expired.
+*/
+uint8_t bt_send_bytes_blocking(uint8_t *bytes, uint16_t len, TickType_t timeout);
+
+#if BUFFER_USE_STATISTICS == 1
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Get the statistics of one of the Board Driver buffers.
+
+Can be used to size the buffers from the traffic seen in the field.
+
+@param[in] buffer_id the buffer to get the statistics for.
+@param[out] *stats pointer to where the statistics are copied.
+*/
+void get_buffer_statistics(board_buffer_t buffer_id, buffer_statistics_t *stats);
+
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Send the statistics of one of the Board Driver buffers to Bluetooth as a text line.
+
+The line has the format "BT_RX peak:12 put:3456 get:3444 drop:0\r\n".
+
+@note The Bluetooth module must be initialised before sending.
+@note The line is formatted in a static buffer, so it must only be called from one task.
+@note The line is formatted with snprintf(), which needs more stack than configMINIMAL_STACK_SIZE leaves - check the
+calling task with uxTaskGetStackHighWaterMark().
+
+@param[in] buffer_id the buffer to send the statistics for.
+
+@return Buffer status [BUFFER_OK, BUFFER_EMPTY, BUFFER_FULL].
+*/
+uint8_t bt_send_buffer_statistics(board_buffer_t buffer_id);
+#endif
+
+#if SPI_BENCHMARK == 1
+//-------------------------------------------------
+/**
+@ingroup board_public_function
+@brief Measure the SPI driver on the IMU sample read (15 bytes at F_CPU/2) and send the result to Bluetooth as a text line.
+
+The read is run count times polled and count times interrupt driven with spi_benchmark().
+The line has the format "SPI polled:123456 B/s 100% irq:98765 B/s 60%\r\n".
+
+@note Only included when SPI_BENCHMARK is 1.
+@note Must be called from the task with the highest priority. The IMU sample reads of the data ready interrupt
+share the bus, so the figures are only clean with the IMU interrupt disabled.
+@note The line is formatted in a static buffer, so it must only be called from one task.
+
+@param[in] count no of reads in each mode.
+
+@return Buffer status [BUFFER_OK, BUFFER_EMPTY, BUFFER_FULL] - BUFFER_EMPTY when the IMU is not initialised or spi_benchmark() failed.
+*/
+uint8_t bt_send_spi_benchmark(uint16_t count);
+#endif
 
 //-------------------------------------------------
 /**
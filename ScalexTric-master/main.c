@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include "include/board.h"
+#include "speed_control/speed_control.h"
 /* Scheduler include files. */
 #include "FreeRTOS/Source/include/FreeRTOS.h"
 
@@ -20,6 +21,10 @@
 
 #define startup_TASK_PRIORITY				( tskIDLE_PRIORITY )
 #define just_a_task_TASK_PRIORITY			( tskIDLE_PRIORITY + 1 )
+#define speed_control_TASK_PRIORITY			( configMAX_PRIORITIES - 1 )
+
+#define TARGET_SPEED_MM_S					2000
+#define TARGET_SPEED_HIGH_MM_S				2700
 
 static const uint8_t _BT_RX_QUEUE_LENGTH = 30; 
 static SemaphoreHandle_t  goal_line_semaphore = NULL;
@@ -35,15 +40,21 @@ static void vstartupTask( void *pvParameters ) {
 	while(1)
 	{
 		if (get_raw_y_accel() > tmp || get_raw_y_accel() < tmp1)
-			set_motor_speed(100);
+			speed_control_set_target(TARGET_SPEED_HIGH_MM_S);
 		else
-			set_motor_speed(75);
+			speed_control_set_target(TARGET_SPEED_MM_S);
+		vTaskDelay(SPEED_CONTROL_PERIOD_MS / portTICK_PERIOD_MS);
 	}
 }
 
 int main(void)
 {
-	init_main_board();
+	if (init_main_board() != BOARD_OK) {
+		// No Blue tooth - stop here with the horn on
+		set_horn(1);
+		while (1);
+	}
+	speed_control_start(speed_control_TASK_PRIORITY);
 	xTaskCreate( vstartupTask, "StartupTask", configMINIMAL_STACK_SIZE, NULL, startup_TASK_PRIORITY, NULL );
 	vTaskStartScheduler();
 }
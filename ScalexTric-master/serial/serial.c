@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <avr/interrupt.h>
 /* ################################################### Project includes ################################################# */
+#include "../FreeRTOS/Source/include/FreeRTOS.h"
+#include "../FreeRTOS/Source/include/task.h"
+#include "../FreeRTOS/Source/include/semphr.h"
+
 #include "serial.h"
 
 /* ################################################### Global Variables ################################################# */
@@ -12,14 +16,35 @@
 // Instance data
 struct serial_struct{
 	volatile uint8_t *ser_UDR;
+	e_com_port_t _com_port;
+	uint32_t _baud;
 	
 	buffer_struct_t *_tx_buf;
 	buffer_struct_t *_rx_buf;
 
 	void(*_call_back )(serial_p,uint8_t);
-};
 
-#define serBAUD_DIV_CONSTANT			8UL
+	// Hardware flow control - _cts_port is NULL when not used
+	volatile uint8_t *_cts_port;
+	uint8_t _cts_pin;
+	volatile uint8_t *_rts_pin_reg;
+	uint8_t _rts_pin;
+	uint16_t _rx_high_watermark;
+	uint16_t _rx_low_watermark;
+	volatile uint8_t _rx_stopped;
+
+	// Idle line detection - _idle_ticks is 0 when not used
+	uint16_t _idle_ticks;
+	volatile uint16_t _idle_count; // ticks left without Timer 4, 0 when not armed
+	volatile uint16_t _frame_count;
+	void(*_frame_call_back )(serial_p,uint16_t);
+
+	// Transmission - _tx_space_semaphore is created by the first blocking send
+	SemaphoreHandle_t _tx_space_semaphore;
+	volatile uint8_t _tx_waiting;
+	uint16_t _tx_wake_level;
+	void(*_tx_drained_call_back )(serial_p);
+};
 
 /* Constants for writing to UCSRA. */
 #define serU2X_ENABLE					0x02
@@ -34,16 +59,36 @@ struct serial_struct{
 #define serEIGHT_DATA_BITS				0x06
 
 #if defined (__AVR_ATmega2560__)
-volatile uint8_t *_com_port_2_udr[] = {&UDR0, &UDR1, &UDR2, &UDR3};
+static volatile uint8_t * const _com_port_2_udr[] = {&UDR0, &UDR1, &UDR2, &UDR3};
 static serial_p _ser_handle[] = {NULL, NULL, NULL, NULL};
 #elif defined (__AVR_ATmega2561__)
-volatile uint8_t  *_com_port_2_udr[] = {&UDR0, &UDR1};
+static volatile uint8_t * const _com_port_2_udr[] = {&UDR0, &UDR1};
 static serial_p _ser_handle[] = {NULL, NULL};
 #else
 #error Serial Driver only implemented for ATMEGA256X
 #endif
 
+/* Idle line detection
+ * Timer 4 and 5 run free with prescaler 64, each port has its own output compare unit
+ * that is moved ahead on every received byte.
+ * The ATmega2561 has no Timer 4 and 5, here a countdown per port is reloaded on every received byte
+ * and counted down by serial_idle_tick() from the 1 ms tick of the board driver. */
+#if defined (TCCR4B)
+#define serIDLE_TIMER_PRESCALER			64UL
+#define serIDLE_TIMER_START				( _BV(CS41) | _BV(CS40) )
+
+static volatile uint16_t * const _com_port_2_idle_tcnt[] = {&TCNT4, &TCNT4, &TCNT4, &TCNT5};
+static volatile uint16_t * const _com_port_2_idle_ocr[] = {&OCR4A, &OCR4B, &OCR4C, &OCR5A};
+static volatile uint8_t * const _com_port_2_idle_timsk[] = {&TIMSK4, &TIMSK4, &TIMSK4, &TIMSK5};
+static volatile uint8_t * const _com_port_2_idle_tifr[] = {&TIFR4, &TIFR4, &TIFR4, &TIFR5};
+static volatile uint8_t * const _com_port_2_idle_tccrb[] = {&TCCR4B, &TCCR4B, &TCCR4B, &TCCR5B};
+static const uint8_t _com_port_2_idle_mask[] = {_BV(OCIE4A), _BV(OCIE4B), _BV(OCIE4C), _BV(OCIE5A)};
+#else
+#define serIDLE_TICK_HZ					1000UL
+#endif
+
 /* Offset to registers from UDR */
+#define UBRRH_off	1
 #define UBRR_off	2
 #define UCSRC_off	4
 #define UCSRB_off	5
@@ -60,7 +105,6 @@ cli();
 #define ES_LEAVE_CRITICAL_SECTION	\
 SREG = _sreg;
 
-
 /*-----------------------------------------------------------*/
 static void _serial_tx_int_on(volatile uint8_t *UDR_reg) {
 	*(UDR_reg  - UCSRB_off) |= serTX_INT_ENABLE;
@@ -71,26 +115,51 @@ static void _serial_tx_int_on(volatile uint8_t *UDR_reg) {
 
 /*-----------------------------------------------------------*/
 serial_p serial_new_instance(e_com_port_t com_port, uint32_t baud, e_data_bit_t data_bit, e_stop_bit_t stop_bit, e_parity_t parity, buffer_struct_t *rx_buf, buffer_struct_t *tx_buf, void(*handler_call_back )(serial_p, uint8_t)) {
+	uint16_t _ubrr;
+	uint8_t _double_speed;
+
+	if (serial_calc_baud(baud, &_ubrr, &_double_speed) > SERIAL_MAX_BAUD_ERROR_PERMILLE) {
+		return NULL;
+	}
+
 	serial_p _serial = malloc(sizeof *_serial);
 	_ser_handle[com_port] = _serial;
 	
 	_serial->ser_UDR = _com_port_2_udr[com_port];
+	_serial->_com_port = com_port;
+	_serial->_baud = baud;
 
 	_serial->_tx_buf = tx_buf;
 	_serial->_rx_buf = rx_buf;
 	
 	_serial->_call_back = handler_call_back;
 	
+	_serial->_cts_port = NULL;
+	_serial->_rts_pin_reg = NULL;
+	_serial->_rx_stopped = 0;
+	
+	_serial->_idle_ticks = 0;
+	_serial->_idle_count = 0;
+	_serial->_frame_count = 0;
+	_serial->_frame_call_back = NULL;
+	
+	_serial->_tx_space_semaphore = NULL;
+	_serial->_tx_waiting = 0;
+	_serial->_tx_drained_call_back = NULL;
+	
 	ES_INIT_CRITICAL_SECTION
 	ES_ENTER_CRITICAL_SECTION
 	{
-		/* Calculate the baud rate register value from the equation in the
-		data sheet. */
-		/* Set double speed */
-		*(_serial->ser_UDR - UCSRA_off) |= serU2X_ENABLE;
+		/* Set normal or double speed - whatever gives the lowest error */
+		if (_double_speed) {
+			*(_serial->ser_UDR - UCSRA_off) |= serU2X_ENABLE;
+		} else {
+			*(_serial->ser_UDR - UCSRA_off) &= ~serU2X_ENABLE;
+		}
 		
-		/* Set the baud rate. */
-		*(_serial->ser_UDR - UBRR_off) = ( F_CPU / ( serBAUD_DIV_CONSTANT * baud ) - 1UL);
+		/* Set the baud rate - writing the low byte updates the prescaler, so high byte first. */
+		*(_serial->ser_UDR - UBRRH_off) = (uint8_t)(_ubrr >> 8);
+		*(_serial->ser_UDR - UBRR_off) = (uint8_t)_ubrr;
 
 		/* Enable the Rx interrupt.  The Tx interrupt will get enabled
 		later. Also enable the Rx and Tx. */
@@ -117,153 +186,338 @@ uint8_t serial_send_byte(serial_p handle, uint8_t byte )
 }
 
 /*-----------------------------------------------------------*/
-uint8_t serial_send_bytes(serial_p handle, uint8_t *buf, uint8_t len )
+uint8_t serial_send_bytes(serial_p handle, uint8_t *buf, uint16_t len )
 {
-	// Check if buffer is full
-	if ( ((handle->_tx_buf != 0) && (len > (BUFFER_SIZE - handle->_tx_buf->no_in_buffer))) || ((handle->_tx_buf == 0) && (len > 1)) ) {
+	if (handle->_tx_buf == 0) {
 		return BUFFER_FULL;
 	}
-	
-	// Put in the tx buffer
-	for (uint8_t i = 0; i < len; i++) {
-		buffer_put_item(handle->_tx_buf, buf[i]);
+
+	// Put in the tx buffer if there is room - the ISR can only free more space meanwhile
+	if (buffer_put_items(handle->_tx_buf, buf, len) != BUFFER_OK) {
+		return BUFFER_FULL;
 	}
 	_serial_tx_int_on(handle->ser_UDR);
 	return BUFFER_OK;
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART0_RX_vect)
+uint8_t serial_send_bytes_blocking(serial_p handle, uint8_t *buf, uint16_t len, TickType_t timeout)
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART0]) {
-		item = UDR0;
-		buffer_put_item(_ser_handle[ser_USART0]->_rx_buf, item);
+	TimeOut_t _time_out;
+	uint16_t _chunk;
+
+	if (handle->_tx_buf == 0) {
+		return BUFFER_FULL;
+	}
+
+	if (handle->_tx_space_semaphore == NULL) {
+		handle->_tx_space_semaphore = xSemaphoreCreateBinary();
+		if (handle->_tx_space_semaphore == NULL) {
+			return BUFFER_FULL;
+		}
+	}
+
+	vTaskSetTimeOutState(&_time_out);
+	while (len > 0) {
+		// Send what there is room for
+		_chunk = buffer_free_space(handle->_tx_buf);
+		if (_chunk > 0) {
+			if (_chunk > len) {
+				_chunk = len;
+			}
+			buffer_put_items(handle->_tx_buf, buf, _chunk);
+			_serial_tx_int_on(handle->ser_UDR);
+			buf += _chunk;
+			len -= _chunk;
+			continue;
+		}
+
+		// Wait for the ISR to free half the buffer, or what is left to send
+		_chunk = handle->_tx_buf->size / 2;
+		handle->_tx_wake_level = (len < _chunk) ? len : _chunk;
+		handle->_tx_waiting = 1;
 		
-		if (_ser_handle[ser_USART0]->_call_back) {
-			_ser_handle[ser_USART0]->_call_back(_ser_handle[ser_USART0], item);
+		// The ISR can have made room before it saw _tx_waiting
+		if (buffer_free_space(handle->_tx_buf) == 0) {
+			if (xTaskCheckForTimeOut(&_time_out, &timeout) != pdFALSE) {
+				handle->_tx_waiting = 0;
+				return BUFFER_FULL;
+			}
+			xSemaphoreTake(handle->_tx_space_semaphore, timeout);
 		}
+		handle->_tx_waiting = 0;
 	}
+	return BUFFER_OK;
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART0_UDRE_vect)
+void serial_set_tx_drained_call_back(serial_p handle, void(*drained_call_back )(serial_p))
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART0]) {
-		if ((buffer_get_item(_ser_handle[ser_USART0]->_tx_buf, &item) == BUFFER_OK)) {
-			UDR0 = item;
-		}
-		else
-		{
-			SERIAL_TX_INT_OFF(UCSR0B);
-		}
-	}
-	
-	else
+	ES_INIT_CRITICAL_SECTION
+	ES_ENTER_CRITICAL_SECTION
+	handle->_tx_drained_call_back = drained_call_back;
+	ES_LEAVE_CRITICAL_SECTION
+}
+
+/*-----------------------------------------------------------*/
+/* Called from ISR - wake the task blocked in serial_send_bytes_blocking() */
+static void _serial_wake_sender(serial_p handle)
+{
+	signed portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+
+	handle->_tx_waiting = 0;
+	xSemaphoreGiveFromISR(handle->_tx_space_semaphore, &xHigherPriorityTaskWoken);
+
+	if( xHigherPriorityTaskWoken != pdFALSE )
 	{
-		SERIAL_TX_INT_OFF(UCSR0B);
+		taskYIELD();
 	}
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART1_RX_vect)
+void serial_set_flow_control(serial_p handle, volatile uint8_t *cts_port, uint8_t cts_pin, volatile uint8_t *rts_pin_reg, uint8_t rts_pin, uint16_t rx_high_watermark, uint16_t rx_low_watermark)
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART1]) {
-		item = UDR1;
-		buffer_put_item(_ser_handle[ser_USART1]->_rx_buf, item);
-		if (_ser_handle[ser_USART1]->_call_back) {
-			_ser_handle[ser_USART1]->_call_back(_ser_handle[ser_USART1], item);
-		}
+	ES_INIT_CRITICAL_SECTION
+	ES_ENTER_CRITICAL_SECTION
+	{
+		handle->_cts_pin = cts_pin;
+		handle->_rts_pin_reg = rts_pin_reg;
+		handle->_rts_pin = rts_pin;
+		handle->_rx_high_watermark = rx_high_watermark;
+		handle->_rx_low_watermark = rx_low_watermark;
+		handle->_rx_stopped = 0;
+		handle->_cts_port = cts_port;
+
+		*(cts_port - 1) |= _BV(cts_pin); // set CTS pin to output
+		*cts_port &= ~_BV(cts_pin); // CTS Low/active - allowed to send
+		*(rts_pin_reg + 1) &= ~_BV(rts_pin); // set RTS pin to input
 	}
+	ES_LEAVE_CRITICAL_SECTION
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART1_UDRE_vect)
+void serial_set_idle_detection(serial_p handle, uint8_t idle_bits, void(*frame_call_back )(serial_p, uint16_t))
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART1]) {
-		if ((buffer_get_item(_ser_handle[ser_USART1]->_tx_buf, &item) == BUFFER_OK)) {
-			UDR1 = item;
+#if defined (TCCR4B)
+	e_com_port_t _port = handle->_com_port;
+#endif
+	uint32_t _ticks = 0;
+
+	if (idle_bits && frame_call_back) {
+#if defined (TCCR4B)
+		// Round up so the line is idle at least idle_bits
+		uint32_t _div = serIDLE_TIMER_PRESCALER * handle->_baud;
+		_ticks = ((uint32_t)idle_bits * F_CPU + _div - 1) / _div;
+#else
+		// Round up and add a tick, the first tick may come right after the byte
+		_ticks = ((uint32_t)idle_bits * serIDLE_TICK_HZ + handle->_baud - 1) / handle->_baud + 1;
+#endif
+		if (_ticks > UINT16_MAX) {
+			_ticks = UINT16_MAX;
 		}
-		else
-		{
-			SERIAL_TX_INT_OFF(UCSR1B);
+	}
+
+	ES_INIT_CRITICAL_SECTION
+	ES_ENTER_CRITICAL_SECTION
+	{
+#if defined (TCCR4B)
+		*_com_port_2_idle_timsk[_port] &= ~_com_port_2_idle_mask[_port];
+#endif
+		handle->_frame_call_back = frame_call_back;
+		handle->_frame_count = 0;
+		handle->_idle_ticks = _ticks;
+		handle->_idle_count = 0;
+
+#if defined (TCCR4B)
+		if (_ticks) {
+			// Start the timer - normal mode
+			*_com_port_2_idle_tccrb[_port] |= serIDLE_TIMER_START;
 		}
+#endif
+	}
+	ES_LEAVE_CRITICAL_SECTION
+}
+
+/*-----------------------------------------------------------*/
+void serial_resume_tx(serial_p handle)
+{
+	if (!buffer_is_empty(handle->_tx_buf)) {
+		_serial_tx_int_on(handle->ser_UDR);
 	}
+}
+
+/*-----------------------------------------------------------*/
+/* Let the other end send again when the rx buffer is drained to the low watermark */
+static void _serial_rx_flow_check(serial_p handle)
+{
+	ES_INIT_CRITICAL_SECTION
 	
-	else
-	{
-		SERIAL_TX_INT_OFF(UCSR1B);
+	if (handle->_cts_port == NULL) {
+		return; // No flow control
+	}
+	
+	// Tested in the critical section - the RX ISR sets _rx_stopped and fills the buffer
+	ES_ENTER_CRITICAL_SECTION
+	if (handle->_rx_stopped && (buffer_no_of_items(handle->_rx_buf) <= handle->_rx_low_watermark)) {
+		handle->_rx_stopped = 0;
+		*(handle->_cts_port) &= ~_BV(handle->_cts_pin);
 	}
+	ES_LEAVE_CRITICAL_SECTION
+}
+
+/*-----------------------------------------------------------*/
+uint8_t serial_get_byte(serial_p handle, uint8_t *byte)
+{
+	uint8_t _result = buffer_get_item(handle->_rx_buf, byte);
+
+	_serial_rx_flow_check(handle);
+	return _result;
 }
 
+/*-----------------------------------------------------------*/
+uint16_t serial_get_bytes(serial_p handle, uint8_t *buf, uint16_t len)
+{
+	uint16_t _no_of_items = buffer_no_of_items(handle->_rx_buf);
+
+	if (len > _no_of_items) {
+		len = _no_of_items;
+	}
+	buffer_get_items(handle->_rx_buf, buf, len);
+
+	_serial_rx_flow_check(handle);
+	return len;
+}
 
-#if defined (__AVR_ATmega2560__)
 /*-----------------------------------------------------------*/
-ISR(USART2_RX_vect)
+/* Shared RX ISR body - inlined into each vector so port is a constant and the UDR address is resolved at compile time */
+static inline __attribute__((always_inline)) void _serial_rx_isr(e_com_port_t port)
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART2]) {
-		item = UDR2;
-		buffer_put_item(_ser_handle[ser_USART2]->_rx_buf, item);
-		if (_ser_handle[ser_USART2]->_call_back) {
-			_ser_handle[ser_USART2]->_call_back(_ser_handle[ser_USART2], item);
+	// Always read UDR to clear the interrupt flag
+	uint8_t item = *_com_port_2_udr[port];
+	serial_p handle = _ser_handle[port];
+
+	if (handle) {
+		if (handle->_rx_buf) {
+			buffer_put_item(handle->_rx_buf, item);
+
+			// Stop the other end when the rx buffer reaches the high watermark
+			if (handle->_cts_port && (buffer_no_of_items(handle->_rx_buf) >= handle->_rx_high_watermark)) {
+				handle->_rx_stopped = 1;
+				*(handle->_cts_port) |= _BV(handle->_cts_pin);
+			}
+		}
+
+		// Move the idle timeout ahead
+		if (handle->_idle_ticks) {
+			handle->_frame_count++;
+#if defined (TCCR4B)
+			*_com_port_2_idle_ocr[port] = *_com_port_2_idle_tcnt[port] + handle->_idle_ticks;
+			*_com_port_2_idle_tifr[port] = _com_port_2_idle_mask[port]; // clear a pending compare
+			*_com_port_2_idle_timsk[port] |= _com_port_2_idle_mask[port];
+#else
+			handle->_idle_count = handle->_idle_ticks;
+#endif
+		}
+
+		void(*call_back)(serial_p, uint8_t) = handle->_call_back;
+		if (call_back) {
+			call_back(handle, item);
 		}
 	}
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART2_UDRE_vect)
+/* Shared UDRE ISR body - inlined into each vector the same way as _serial_rx_isr() */
+static inline __attribute__((always_inline)) void _serial_udre_isr(e_com_port_t port)
 {
 	uint8_t item;
-	if (_ser_handle[ser_USART2]) {
-		if ((buffer_get_item(_ser_handle[ser_USART2]->_tx_buf, &item) == BUFFER_OK)) {
-			UDR2 = item;
-		}
-		else
-		{
-			SERIAL_TX_INT_OFF(UCSR2B);
+	serial_p handle = _ser_handle[port];
+
+	// Pause while the other end holds RTS high - serial_resume_tx() starts again
+	if (handle && handle->_rts_pin_reg && (*(handle->_rts_pin_reg) & _BV(handle->_rts_pin))) {
+		SERIAL_TX_INT_OFF(*(_com_port_2_udr[port] - UCSRB_off));
+		return;
+	}
+
+	if (handle && (buffer_get_item(handle->_tx_buf, &item) == BUFFER_OK)) {
+		*_com_port_2_udr[port] = item;
+
+		if (handle->_tx_waiting && (buffer_free_space(handle->_tx_buf) >= handle->_tx_wake_level)) {
+			_serial_wake_sender(handle);
 		}
 	}
-	
 	else
 	{
-		SERIAL_TX_INT_OFF(UCSR2B);
+		SERIAL_TX_INT_OFF(*(_com_port_2_udr[port] - UCSRB_off));
+
+		if (handle) {
+			if (handle->_tx_waiting) {
+				_serial_wake_sender(handle);
+			}
+
+			void(*drained_call_back)(serial_p) = handle->_tx_drained_call_back;
+			if (drained_call_back) {
+				drained_call_back(handle);
+			}
+		}
 	}
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART3_RX_vect)
+/* Shared idle line ISR body - the line has been idle since the last byte */
+static inline __attribute__((always_inline)) void _serial_idle_isr(e_com_port_t port)
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART3]) {
-		item = UDR3;
-		buffer_put_item(_ser_handle[ser_USART3]->_rx_buf, item);
-		if (_ser_handle[ser_USART3]->_call_back) {
-			_ser_handle[ser_USART3]->_call_back(_ser_handle[ser_USART3], item);
-		}
+	serial_p handle = _ser_handle[port];
+
+	// One shot - armed again by the next received byte
+#if defined (TCCR4B)
+	*_com_port_2_idle_timsk[port] &= ~_com_port_2_idle_mask[port];
+#endif
+
+	if (handle && handle->_frame_call_back) {
+		uint16_t _count = handle->_frame_count;
+		handle->_frame_count = 0;
+		handle->_frame_call_back(handle, _count);
 	}
 }
 
 /*-----------------------------------------------------------*/
-ISR(USART3_UDRE_vect)
+void serial_idle_tick(void)
 {
-	uint8_t item;
-	if (_ser_handle[ser_USART3]) {
-		if ((buffer_get_item(_ser_handle[ser_USART3]->_tx_buf, &item) == BUFFER_OK)) {
-			UDR3 = item;
-		}
-		else
-		{
-			SERIAL_TX_INT_OFF(UCSR3B);
+#if !defined (TCCR4B)
+	for (uint8_t _port = 0; _port < sizeof(_ser_handle) / sizeof(_ser_handle[0]); _port++) {
+		serial_p handle = _ser_handle[_port];
+
+		if (handle && handle->_idle_count && (--handle->_idle_count == 0)) {
+			_serial_idle_isr(_port);
 		}
 	}
-	
-	else
-	{
-		SERIAL_TX_INT_OFF(UCSR3B);
-	}
+#endif
 }
-#endif
\ No newline at end of file
+
+/*-----------------------------------------------------------*/
+#if SERIAL_BENCHMARK == 1
+/* Pin high while the ISR body of the measured port runs - the port is a constant, so the test is folded away */
+#define serBENCHMARK_START(port)		if ((port) == SERIAL_BENCHMARK_USART) { SERIAL_BENCHMARK_PORT |= _BV(SERIAL_BENCHMARK_PIN); }
+#define serBENCHMARK_STOP(port)			if ((port) == SERIAL_BENCHMARK_USART) { SERIAL_BENCHMARK_PORT &= ~_BV(SERIAL_BENCHMARK_PIN); }
+#else
+#define serBENCHMARK_START(port)
+#define serBENCHMARK_STOP(port)
+#endif
+
+#define SERIAL_ISR(n)									\
+ISR(USART##n##_RX_vect) { serBENCHMARK_START(ser_USART##n) _serial_rx_isr(ser_USART##n); serBENCHMARK_STOP(ser_USART##n) }		\
+ISR(USART##n##_UDRE_vect) { serBENCHMARK_START(ser_USART##n) _serial_udre_isr(ser_USART##n); serBENCHMARK_STOP(ser_USART##n) }
+
+SERIAL_ISR(0)
+SERIAL_ISR(1)
+#if defined (__AVR_ATmega2560__)
+SERIAL_ISR(2)
+SERIAL_ISR(3)
+#endif
+#if defined (TCCR4B)
+ISR(TIMER4_COMPA_vect) { _serial_idle_isr(ser_USART0); }
+ISR(TIMER4_COMPB_vect) { _serial_idle_isr(ser_USART1); }
+ISR(TIMER4_COMPC_vect) { _serial_idle_isr(ser_USART2); }
+ISR(TIMER5_COMPA_vect) { _serial_idle_isr(ser_USART3); }
+#endif
@@ -17,8 +17,35 @@
 
 #include <stdint.h>
 
+#include "../FreeRTOS/Source/include/FreeRTOS.h"
+
 #include "../buffer/buffer.h"
 
+/**
+@ingroup serial_driver
+@brief Max baud rate error accepted by serial_new_instance() [per mille].
+*/
+#define SERIAL_MAX_BAUD_ERROR_PERMILLE	20
+
+/**
+@ingroup serial_driver
+@brief Set to 1 to measure the cost of the USART ISRs on the target.
+
+SERIAL_BENCHMARK_PORT/SERIAL_BENCHMARK_PIN is high while the RX or UDRE ISR body of SERIAL_BENCHMARK_USART runs.
+Measure the pulse width with a scope or logic analyser, 62.5 ns per cycle at 16 MHz.
+The set and clear of the pin (2 cycles each) are included, the vector prologue and epilogue are not.
+*/
+#ifndef SERIAL_BENCHMARK
+#define SERIAL_BENCHMARK 0
+#endif
+#if SERIAL_BENCHMARK == 1
+/** @brief The port that is measured. */
+#define SERIAL_BENCHMARK_USART			ser_USART0
+/** @brief The AUX pin of the main board. */
+#define SERIAL_BENCHMARK_PORT			PORTC
+#define SERIAL_BENCHMARK_PIN			PC0
+#endif
+
 // Abstract Data Type (ADT)
 typedef struct serial_struct *serial_p;
 
@@ -59,16 +86,67 @@ typedef enum
 
 @todo Documentation
 
+@return handle to the new instance, or NULL if the baud rate cannot be made within SERIAL_MAX_BAUD_ERROR_PERMILLE.
+
+@note rx_buf and tx_buf must be initialized with buffer_init_spsc(), they are shared with the ISRs without disabling interrupts.
+@note Only one task may send to the same instance.
 */
 serial_p serial_new_instance(e_com_port_t com_port, uint32_t baud, e_data_bit_t data_bit, e_stop_bit_t stop_bit, e_parity_t parity, buffer_struct_t *rx_buf, buffer_struct_t *tx_buf, void(*handler_call_back )(serial_p, uint8_t));
 /* ======================================================================================================================= */
 /**
 @ingroup serial_driver
+@brief Calculate the baud rate register setting for a baud rate.
+
+Both normal and double speed are tried, and the one with the lowest error is chosen.
+UBRR is rounded to the nearest value.
+
+@return the error between the requested and the actual baud rate [per mille] rounded up, UINT16_MAX if the rate cannot be made.
+@param baud the requested baud rate.
+@param *ubrr pointer to where the UBRR value is returned [0..4095].
+@param *double_speed pointer to where 1 is returned if U2X must be set, 0 otherwise.
+*/
+uint16_t serial_calc_baud(uint32_t baud, uint16_t *ubrr, uint8_t *double_speed);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
 
 @todo Documentation
 
 */
-uint8_t serial_send_bytes(serial_p handle, uint8_t *buf, uint8_t len);
+uint8_t serial_send_bytes(serial_p handle, uint8_t *buf, uint16_t len);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Send bytes of any length, blocking the calling task while the tx buffer is full.
+
+The bytes are put in the tx buffer as room gets available. The task sleeps until the ISR has freed half the tx buffer,
+or room for the rest of the bytes.
+
+@note Must be called from a FreeRTOS task.
+@note Only one task may send to the same instance.
+
+@return BUFFER_OK: all bytes are in the tx buffer.\n
+BUFFER_FULL: timeout - only part of the bytes are sent.
+@param handle instance to send to.
+@param *buf pointer to the bytes to send.
+@param len no of bytes to send.
+@param timeout max no of ticks to wait in total.
+*/
+uint8_t serial_send_bytes_blocking(serial_p handle, uint8_t *buf, uint16_t len, TickType_t timeout);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Set a call back function to be called when the tx buffer has been drained.
+
+@note The function is called from the ISR when the last byte is moved to the transmitter.
+
+@param handle instance to set the call back on.
+@param *drained_call_back pointer to the function to call, NULL to remove it. The function should have the following signature:\n
+@code
+void handler_name(serial_p serial_instance)
+@endcode
+*/
+void serial_set_tx_drained_call_back(serial_p handle, void(*drained_call_back )(serial_p));
 /* ======================================================================================================================= */
 /**
 @ingroup serial_driver
@@ -78,5 +156,89 @@ uint8_t serial_send_bytes(serial_p handle, uint8_t *buf, uint8_t len);
 */
 uint8_t serial_send_byte(serial_p handle, uint8_t byte);
 
-#endif
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Enable RTS/CTS hardware flow control on an instance.
+
+CTS is set high when the rx buffer holds rx_high_watermark bytes, and set low again when serial_get_byte() has
+drained it to rx_low_watermark bytes.
+Transmission is paused while RTS is high. There is no interrupt on RTS, so serial_resume_tx() must be called
+periodically to start the transmission again.
+
+@note Both CTS and RTS are active low.
+
+@param handle instance to enable flow control on.
+@param *cts_port port register for the CTS output - Ex. PORTE.
+@param cts_pin CTS pin - Ex. PE5.
+@param *rts_pin_reg pin register for the RTS input - Ex. PINE.
+@param rts_pin RTS pin - Ex. PE2.
+@param rx_high_watermark no of bytes in the rx buffer where CTS is set high.
+@param rx_low_watermark no of bytes in the rx buffer where CTS is set low again.
+*/
+void serial_set_flow_control(serial_p handle, volatile uint8_t *cts_port, uint8_t cts_pin, volatile uint8_t *rts_pin_reg, uint8_t rts_pin, uint16_t rx_high_watermark, uint16_t rx_low_watermark);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Enable idle line detection on an instance.
+
+When the line has been idle for idle_bits bit times after a received byte, frame_call_back is called from the ISR
+with the number of bytes received since the last call.
+
+@note Timer 4 is used for USART0-2 (output compare A-C) and Timer 5 for USART3 (output compare A). The timers run free
+with prescaler 64, so the resolution is 4 us at 16 MHz and the max idle time is 262 ms.
+@note The ATmega2561 has no Timer 4 and 5, there the idle time is counted by serial_idle_tick() in whole ticks of 1 ms,
+plus one tick as the first tick may come right after the last byte.
+
+@param handle instance to enable idle detection on.
+@param idle_bits no of bit times the line must be idle, 0 disables the detection.
+@param *frame_call_back pointer to the function to call when the line gets idle. The function should have the following signature:\n
+@code
+void handler_name(serial_p serial_instance, uint16_t no_of_bytes)
+@endcode
+*/
+void serial_set_idle_detection(serial_p handle, uint8_t idle_bits, void(*frame_call_back )(serial_p, uint16_t));
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Count down the idle time of all instances, when the line has been idle long enough the frame call back is called.
+
+@note Must be called every 1 ms from an ISR on targets without Timer 4 (ATmega2561), it does nothing on other targets.
+*/
+void serial_idle_tick(void);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Start transmission again if it is paused by RTS and there is data to send.
+
+@param handle instance to resume.
+*/
+void serial_resume_tx(serial_p handle);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Get a received byte from the rx buffer.
+
+@note Only one context may get bytes from the same instance.
+
+@return BUFFER_OK: byte returned in byte.\n
+BUFFER_EMPTY: nothing received, byte is not updated.
+@param handle instance to get from.
+@param *byte pointer to where the byte is returned.
+*/
+uint8_t serial_get_byte(serial_p handle, uint8_t *byte);
+/* ======================================================================================================================= */
+/**
+@ingroup serial_driver
+@brief Get the received bytes from the rx buffer.
 
+@note Only one context may get bytes from the same instance.
+
+@return no of bytes returned in buf [0..len].
+@param handle instance to get from.
+@param *buf pointer to where the bytes are returned.
+@param len max no of bytes to get.
+*/
+uint16_t serial_get_bytes(serial_p handle, uint8_t *buf, uint16_t len);
+
+#endif
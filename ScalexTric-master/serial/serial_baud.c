@@ -0,0 +1,51 @@
+/*! @file serial_baud.c
+@brief Baud rate calculation for the serial driver.
+
+Kept apart from serial.c because it does not touch the hardware, so it can be tested on a host.
+*/
+
+/* ################################################## Standard includes ################################################# */
+
+/* ################################################### Project includes ################################################# */
+#include "serial.h"
+
+/* ############################################ Module Variables/Declarations ########################################### */
+#define serBAUD_DIV_NORMAL				16UL
+#define serBAUD_DIV_DOUBLE_SPEED		8UL
+#define serUBRR_MAX						4095UL
+
+/*-----------------------------------------------------------*/
+/* Calculate rounded UBRR for the divider and return the resulting baud rate error in per mille */
+static uint16_t _serial_baud_error(uint32_t baud, uint32_t divider, uint16_t *ubrr) {
+	uint32_t _div_baud = divider * baud;
+	uint32_t _n = (F_CPU + _div_baud / 2) / _div_baud; // UBRR + 1 rounded to nearest
+
+	if ((_n == 0) || (_n > serUBRR_MAX + 1)) {
+		return UINT16_MAX;
+	}
+	*ubrr = _n - 1;
+
+	uint32_t _actual = _n * _div_baud; // F_CPU at the exact rate
+	uint32_t _diff = (_actual > F_CPU) ? _actual - F_CPU : F_CPU - _actual;
+	// Rounded up, so an error just above the limit is not accepted.
+	// A diff too big for the multiply is an error above 170 per mille, where the truncated result plus one will do
+	if (_diff > UINT32_MAX / 1000UL) {
+		return _diff / (_actual / 1000UL) + 1;
+	}
+	return (_diff * 1000UL + _actual - 1) / _actual;
+}
+
+/*-----------------------------------------------------------*/
+uint16_t serial_calc_baud(uint32_t baud, uint16_t *ubrr, uint8_t *double_speed) {
+	uint16_t _ubrr_double;
+	uint16_t _error = (baud == 0) ? UINT16_MAX : _serial_baud_error(baud, serBAUD_DIV_NORMAL, ubrr);
+	uint16_t _error_double = (baud == 0) ? UINT16_MAX : _serial_baud_error(baud, serBAUD_DIV_DOUBLE_SPEED, &_ubrr_double);
+
+	// Normal speed samples more times per bit, so it is preferred when the error is the same
+	*double_speed = (_error_double < _error);
+	if (*double_speed) {
+		*ubrr = _ubrr_double;
+		_error = _error_double;
+	}
+	return _error;
+}
@@ -0,0 +1,241 @@
+/** @file speed_control.c
+@brief Closed loop speed control of the car.
+
+@defgroup speed_control Speed Control
+@{
+A task runs a PID controller every SPEED_CONTROL_PERIOD_MS with the filtered tacho speed as feedback.
+The output is the sum of a feed forward from the target speed and the PID terms, a positive output sets the
+motor speed and a negative output brakes, both with per mille resolution.
+The motor ramps of the board driver (set_motor_ramp()) limit how fast the output is applied.
+
+All calculations are done in fixed point, the gains are converted to the period of the loop when they are set:
+- The output is in Q16 [%].
+- The integral is in Q24 [%], it is clamped to +/-100% and is not integrated further into saturation (anti windup).
+  It is also held while the motor ramp has not reached the last output, so the ramp does not wind it up.
+- The derivative is on the measured speed, so changing the target does not kick the output.
+
+The loop is scheduled with vTaskDelayUntil() and its timing is measured with get_time_us(), see speed_control_get_timing().
+
+@defgroup speed_control_config Speed Control Configuration
+@brief Compile time defaults.
+
+@defgroup speed_control_public Speed Control Functions
+@brief Used from the application.
+@}
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "speed_control.h"
+#include "../include/board.h"
+#include "../FreeRTOS/Source/include/task.h"
+
+// Gains in Q8 converted to the loop
+#define _KP_Q16(kp) ((int32_t)(kp) * 256 / 1000)
+// ki * 65536 is max 65535 * 65536, which just fits in 32 bits
+#define _KI_Q24(ki) ((int32_t)((uint32_t)(ki) * 65536UL / (1000000UL / SPEED_CONTROL_PERIOD_MS)))
+#define _KD_Q16(kd) ((int32_t)(kd) * 256 / SPEED_CONTROL_PERIOD_MS)
+
+#define _OUTPUT_MAX_Q16 (100L << 16)
+#define _INTEGRAL_MAX_Q24 (100L << 24)
+#define _TERM_MAX_Q16 (200L << 16)
+// Limits keeping the products inside 32 bits
+#define _ERROR_MAX_MM_S 10000L
+#define _DELTA_MAX_MM_S 1000L
+
+static volatile uint16_t _target_mm_s = 0;
+static int32_t _ff_q16 = 0;
+static int32_t _kp_q16 = _KP_Q16(SPEED_CONTROL_DEFAULT_KP);
+static int32_t _ki_q24 = _KI_Q24(SPEED_CONTROL_DEFAULT_KI);
+static int32_t _kd_q16 = _KD_Q16(SPEED_CONTROL_DEFAULT_KD);
+
+static int32_t _integral_q24 = 0;
+static int32_t _last_speed_mm_s = 0;
+static int16_t _last_output_permille = 0;
+
+static speed_control_timing_t _timing = {UINT16_MAX, 0, 0, 0, 0};
+static uint8_t _timing_valid = 0;
+static TaskHandle_t _speed_control_task_handle = NULL;
+
+// ----------------------------------------------------------------------------------------------------------------------
+static int32_t _clamp(int32_t value, int32_t limit) {
+	if (value > limit) {
+		return limit;
+	}
+	if (value < -limit) {
+		return -limit;
+	}
+	return value;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void _speed_control_update() {
+	uint8_t _sreg = SREG;
+	cli();
+	uint16_t _target = _target_mm_s;
+	int32_t _ff = _ff_q16;
+	int32_t _kp = _kp_q16;
+	int32_t _ki = _ki_q24;
+	int32_t _kd = _kd_q16;
+	SREG = _sreg;
+
+	int32_t _speed = (int32_t)get_filtered_speed();
+	int32_t _delta = _clamp(_speed - _last_speed_mm_s, _DELTA_MAX_MM_S);
+	_last_speed_mm_s = _speed;
+
+	if (_target == 0) {
+		// Stopped - free run and start over
+		_integral_q24 = 0;
+		_last_output_permille = 0;
+		set_motor_speed_permille(0);
+		return;
+	}
+
+	int32_t _error = _clamp((int32_t)_target - _speed, _ERROR_MAX_MM_S);
+	int32_t _output = _ff + _clamp(_error * _kp, _TERM_MAX_Q16) - _clamp(_delta * _kd, _TERM_MAX_Q16) + (_integral_q24 >> 8);
+
+	// The motor ramp may not have reached the last output yet, the motor lags behind in that direction
+	int16_t _ramp_lag = _last_output_permille - get_motor_output_permille();
+
+	// Anti windup - only integrate when it does not drive the output further into saturation,
+	// and not while the ramp holds the motor back, otherwise the integral winds up during every ramp
+	if ((_output < _OUTPUT_MAX_Q16 || _error < 0) && (_output > -_OUTPUT_MAX_Q16 || _error > 0)
+		&& (_ramp_lag <= 0 || _error < 0) && (_ramp_lag >= 0 || _error > 0)) {
+		_integral_q24 = _clamp(_integral_q24 + _error * _ki, _INTEGRAL_MAX_Q24);
+	}
+
+	_output = _clamp(_output, _OUTPUT_MAX_Q16) * 10;
+	if (_output >= 0) {
+		_last_output_permille = (_output + 0x8000L) >> 16;
+		set_motor_speed_permille(_last_output_permille);
+		} else {
+		_last_output_permille = -((-_output + 0x8000L) >> 16);
+		set_brake_permille(-_last_output_permille);
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void _speed_control_log_timing(uint32_t period_us, uint32_t exec_us) {
+	uint8_t _sreg = SREG;
+	cli();
+	if (_timing_valid) {
+		uint16_t _period = (period_us > UINT16_MAX) ? UINT16_MAX : period_us;
+		if (_period < _timing.min_period_us) {
+			_timing.min_period_us = _period;
+		}
+		if (_period > _timing.max_period_us) {
+			_timing.max_period_us = _period;
+		}
+		_timing.loops++;
+	}
+	if (exec_us > _timing.max_exec_us) {
+		_timing.max_exec_us = (exec_us > UINT16_MAX) ? UINT16_MAX : exec_us;
+	}
+	_timing_valid = 1;
+	SREG = _sreg;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void _speed_control_task(void *pvParameters) {
+	( void ) pvParameters;
+
+	TickType_t _last_wake = xTaskGetTickCount();
+	uint32_t _last_start_us = 0;
+
+	for (;;) {
+		vTaskDelayUntil(&_last_wake, SPEED_CONTROL_PERIOD_MS / portTICK_PERIOD_MS);
+
+		uint32_t _start_us = get_time_us();
+		_speed_control_update();
+		_speed_control_log_timing(_start_us - _last_start_us, get_time_us() - _start_us);
+		_last_start_us = _start_us;
+	}
+}
+
+/* ======================================================================================================================= */
+/**
+@ingroup speed_control_public
+@brief Start the speed control task.
+
+The car stands still until a target is set with speed_control_set_target().
+
+@note This must be called exactly once, before or after the scheduler is started.
+@note When the controller runs, the motor and brake must not be set from the application.
+
+@note The stack of the task is SPEED_CONTROL_STACK_SIZE, check the margin with stack_free of speed_control_get_timing().
+
+@param priority of the task, it should be the highest priority in the application to keep the jitter low.
+*/
+void speed_control_start(UBaseType_t priority) {
+	xTaskCreate(_speed_control_task, "SpeedControl", SPEED_CONTROL_STACK_SIZE, NULL, priority, &_speed_control_task_handle);
+}
+
+/* ======================================================================================================================= */
+/**
+@ingroup speed_control_public
+@brief Set the speed the controller should keep.
+
+@param speed_mm_s target speed [mm/s], 0: stop the controller and let the motor run free.
+*/
+void speed_control_set_target(uint16_t speed_mm_s) {
+	int32_t _ff = ((int32_t)SPEED_CONTROL_FF_OFFSET_PERCENT << 16) + (int32_t)(((uint32_t)speed_mm_s * SPEED_CONTROL_FF_SLOPE / 1000) << 8);
+
+	uint8_t _sreg = SREG;
+	cli();
+	_target_mm_s = speed_mm_s;
+	_ff_q16 = _clamp(_ff, _OUTPUT_MAX_Q16);
+	SREG = _sreg;
+}
+
+/* ======================================================================================================================= */
+/**
+@ingroup speed_control_public
+@brief Set the PID gains.
+
+The gains are in Q8, use SPEED_CONTROL_GAIN() for constants, e.g. speed_control_set_gains(SPEED_CONTROL_GAIN(30), SPEED_CONTROL_GAIN(2.5), 0).
+
+@param kp proportional gain [%/(m/s)].
+@param ki integral gain [%/m].
+@param kd derivative gain [%/(m/s^2)].
+*/
+void speed_control_set_gains(uint16_t kp, uint16_t ki, uint16_t kd) {
+	int32_t _kp = _KP_Q16(kp);
+	int32_t _ki = _KI_Q24(ki);
+	int32_t _kd = _KD_Q16(kd);
+
+	uint8_t _sreg = SREG;
+	cli();
+	_kp_q16 = _kp;
+	_ki_q24 = _ki;
+	_kd_q16 = _kd;
+	SREG = _sreg;
+}
+
+/* ======================================================================================================================= */
+/**
+@ingroup speed_control_public
+@brief Get the timing of the control loop.
+
+The period is measured between the starts of two loops, the first loop after a reset is not measured.
+The free stack is not reset, it is the least since the task was started.
+
+@param timing where the timing is copied to.
+@param reset 1: start a new measurement.
+*/
+void speed_control_get_timing(speed_control_timing_t *timing, uint8_t reset) {
+	uint16_t _stack_free = _speed_control_task_handle ? uxTaskGetStackHighWaterMark(_speed_control_task_handle) : 0;
+	
+	uint8_t _sreg = SREG;
+	cli();
+	*timing = _timing;
+	timing->stack_free = _stack_free;
+	if (reset) {
+		_timing.min_period_us = UINT16_MAX;
+		_timing.max_period_us = 0;
+		_timing.max_exec_us = 0;
+		_timing.loops = 0;
+		_timing_valid = 0;
+	}
+	SREG = _sreg;
+}
@@ -0,0 +1,59 @@
+/** @file speed_control.h
+
+@ingroup speed_control
+@brief Closed loop speed control of the car.
+*/
+
+#ifndef SPEED_CONTROL_H_
+#define SPEED_CONTROL_H_
+
+#include <stdint.h>
+
+#include "../FreeRTOS/Source/include/FreeRTOS.h"
+
+/**
+@ingroup speed_control_config
+@{
+	@brief Period of the control loop [ms]. */
+	#define SPEED_CONTROL_PERIOD_MS 10
+	/** @brief Default proportional gain [%/(m/s)] in Q8. */
+	#define SPEED_CONTROL_DEFAULT_KP SPEED_CONTROL_GAIN(30)
+	/** @brief Default integral gain [%/m] in Q8. */
+	#define SPEED_CONTROL_DEFAULT_KI SPEED_CONTROL_GAIN(20)
+	/** @brief Default derivative gain [%/(m/s^2)] in Q8. */
+	#define SPEED_CONTROL_DEFAULT_KD SPEED_CONTROL_GAIN(0)
+	/** @brief Feed forward motor speed [%] at 0 mm/s, the motor will not start below ~50%. */
+	#define SPEED_CONTROL_FF_OFFSET_PERCENT 45
+	/** @brief Feed forward slope [%/(m/s)] in Q8. */
+	#define SPEED_CONTROL_FF_SLOPE SPEED_CONTROL_GAIN(15)
+	/** @brief Stack of the task [bytes], the task context (37 bytes) and the PID leave room for the nested ISRs
+	of the board driver (timer 2 tick with the IMU FIFO poll, SPI and USART). */
+	#define SPEED_CONTROL_STACK_SIZE 200
+	/**
+@}
+
+@ingroup speed_control_public
+@brief Converts a constant gain to Q8, e.g. SPEED_CONTROL_GAIN(2.5).
+*/
+#define SPEED_CONTROL_GAIN(x) ((uint16_t)((x) * 256.0 + 0.5))
+
+/**
+@ingroup speed_control_public
+@brief Timing of the control loop.
+
+The jitter of the loop is max_period_us - min_period_us.
+*/
+typedef struct {
+	uint16_t min_period_us; /**< shortest time between two loop starts [us]. */
+	uint16_t max_period_us; /**< longest time between two loop starts [us]. */
+	uint16_t max_exec_us; /**< longest time to read the speed, run the PID and set the motor [us]. */
+	uint32_t loops; /**< no of loops measured. */
+	uint16_t stack_free; /**< least free stack of the task since it was started [bytes], from uxTaskGetStackHighWaterMark(). */
+} speed_control_timing_t;
+
+// ------------- Prototypes -----------------
+void speed_control_start(UBaseType_t priority);
+void speed_control_set_target(uint16_t speed_mm_s);
+void speed_control_set_gains(uint16_t kp, uint16_t ki, uint16_t kd);
+void speed_control_get_timing(speed_control_timing_t *timing, uint8_t reset);
+#endif /* SPEED_CONTROL_H_ */
@@ -35,6 +35,17 @@ Here you you will find the functions you will need.
 @brief Used for setting the data order.
 @}
 
+@defgroup spi_transaction SPI Transactions
+@brief Queued transfers with caller owned buffers.
+
+A transaction describes a complete transfer with one device: the CS is active for the whole transaction.
+Transactions are queued and the ISR runs them back to back, so several devices can share the bus.
+Bytes are moved directly between the callers buffers and the SPI data register.
+Each transaction can run with its own SPI clock, e.g. slow register writes and fast data reads on the same device.
+
+@defgroup spi_transaction_status SPI Transaction status
+@brief Values of spi_transaction_t::status.
+
 @defgroup spi_return_codes SPI Return codes
 @brief Return values from SPI functions.
 @}
@@ -57,6 +68,7 @@ struct spi_struct{
 	uint8_t _cs_active_level;
 	uint8_t _SPCR;
 	uint8_t _SPSR;
+	uint8_t _clock_divider;
 	
 	#if SPI_USE_BUFFER == 1
 	buffer_struct_t *_tx_buf;
@@ -72,9 +84,24 @@ static uint8_t _spi_active = 0; /**< true if the SPI bus is transmitting */
 static spi_p _this = 0; /**< the current active instance of the SPI setup. 0 means no instance is active */
 static uint8_t _initialised = 0; /**< the spi driver is initialised. 0 means not intialised */
 
+static spi_transaction_t *_transaction = 0; /**< the transaction on the bus. 0 means none */
+static spi_transaction_t *_queue_head = 0; /**< next transaction to run */
+static spi_transaction_t *_queue_tail = 0; /**< last transaction in the queue */
+static uint16_t _transaction_index = 0; /**< index of the byte on the bus in the current transaction */
+static uint8_t _in_polled_call_back = 0; /**< true while the call back of a polled transaction is running */
+#if SPI_BENCHMARK == 1
+static uint8_t _benchmark_interrupt_only = 0; /**< true while spi_benchmark() measures the interrupt driven mode */
+#define _POLLING_ALLOWED() (!_benchmark_interrupt_only)
+#else
+#define _POLLING_ALLOWED() 1
+#endif
+
 // Mask for Pre-scaler SPR0 and SPR1
 // Indexed by SPI_CLOCK_DIVIDER_xx defines
-static const uint8_t _prescaler_mask [] = {0b00,0b01,0b10,0b11,0b00,0b01,0b10};
+static const uint8_t _prescaler_mask [] = {0b00,0b00,0b01,0b10,0b11,0b00,0b01,0b10};
+// log2 of the F_CPU divider
+// Indexed by SPI_CLOCK_DIVIDER_xx defines
+static const uint8_t _divider_shift [] = {0,2,4,6,7,1,3,5};
 
 // Send a byte to the SPI-bus
 static inline void _spi_send_byte(uint8_t byte) {
@@ -124,6 +151,72 @@ static void _select_instance(spi_p inst) {
 }
 
 
+// Set the SPI clock of the active instance - must be called with interrupts disabled and the bus idle
+static void _set_clock(uint8_t clock_divider) {
+	if (clock_divider == SPI_CLOCK_DIVIDER_INSTANCE) {
+		clock_divider = _this->_clock_divider;
+	}
+
+	SPCR = (SPCR & ~(_BV(SPR1) | _BV(SPR0))) | _prescaler_mask[clock_divider];
+	
+	if (clock_divider > SPI_CLOCK_DIVIDER_128) {
+		SPSR = _BV(SPI2X);
+		} else {
+		SPSR = 0;
+	}
+}
+
+// Max no of bytes a transaction can have to be run polled
+static inline uint16_t _polled_max_len(spi_transaction_t *transaction) {
+	uint8_t _clock_divider = transaction->clock_divider;
+
+	if (_clock_divider == SPI_CLOCK_DIVIDER_INSTANCE) {
+		_clock_divider = transaction->spi->_clock_divider;
+	}
+
+	// 8 bits of SPI clock per byte
+	return (SPI_POLLED_MAX_CYCLES >> 3) >> _divider_shift[_clock_divider];
+}
+
+// Byte no index to send in a transaction
+static inline uint8_t _tx_byte(spi_transaction_t *transaction, uint16_t index) {
+	if ((transaction->tx == 0) || ((transaction->tx_len != 0) && (index >= transaction->tx_len))) {
+		return 0;
+	}
+	
+	return transaction->tx[index];
+}
+
+// Start the next queued transaction - must be called with interrupts disabled and the bus idle
+static void _start_next_transaction() {
+	spi_transaction_t *_next = _queue_head;
+	
+	if (_next == 0) {
+		return;
+	}
+	
+	_queue_head = _next->_next;
+	if (_queue_head == 0) {
+		_queue_tail = 0;
+	}
+	_next->_next = 0;
+	
+	if (_this != _next->spi) {
+		_select_instance(_next->spi);
+	}
+	_set_clock(_next->clock_divider);
+
+	_transaction = _next;
+	_transaction_index = 0;
+	_next->status = SPI_TRANSACTION_ACTIVE;
+	_spi_active = 1;
+	_set_cs(CS_ACTIVE);
+	// Enable SPI interrupt
+	SPCR |= _BV(SPIE);
+	// Send first byte
+	_spi_send_byte(_tx_byte(_next, 0));
+}
+
 // Initialise the driver
 static void _spi_init() {
 	// SS, SCK, MOSI as output
@@ -191,10 +284,13 @@ buffer_struct_t *rx_buf, buffer_struct_t *tx_buf, void(*call_back )(spi_p spi, u
 	
 	_spi->_cs_active_level = cs_active_level;
 	_spi->_SPCR = mode | _prescaler_mask[clock_divider] |(spi_mode<<2) | data_order;
+	_spi->_SPSR = 0;
 	
-	if (clock_divider > 3) {
+	if (clock_divider > SPI_CLOCK_DIVIDER_128) {
 		_spi->_SPSR = _BV(SPI2X);
 	}
+	
+	_spi->_clock_divider = clock_divider;
 
 	#if SPI_USE_BUFFER == 1
 	_spi->_tx_buf = tx_buf;
@@ -229,6 +325,7 @@ buffer_struct_t *rx_buf, buffer_struct_t *tx_buf, void(*call_back )(spi_p spi, u
 @return \n
 SPI_OK: OK byte send to SPI bus.\n
 SPI_NO_ROOM_IN_TX_BUFFER: Buffer full no data send.\n
+SPI_BUSY: another instance or a transaction is using the bus.\n
 SPI_ILLEGAL_INSTANCE: instance is null.
 
 @param spi to send to.
@@ -239,11 +336,6 @@ uint8_t spi_send_byte(spi_p spi, uint8_t byte) {
 		return SPI_ILLEGAL_INSTANCE;
 	}
 
-	// Select correct instance
-	if (_this != spi ) {
-		_select_instance(spi);
-	}
-
 	uint8_t result = SPI_OK;
 
 	// Critical section
@@ -252,6 +344,22 @@ uint8_t spi_send_byte(spi_p spi, uint8_t byte) {
 		uint8_t c_sreg = SREG;
 		cli();
 
+		// Never switch CS in the middle of a transfer, and let queued transactions go first
+		if ((_transaction != 0) || (_queue_head != 0) || (_spi_active && (_this != spi))) {
+			SREG = c_sreg;
+			return SPI_BUSY;
+		}
+
+		// Select correct instance
+		if (_this != spi ) {
+			_select_instance(spi);
+		}
+		
+		// A transaction may have changed the clock
+		if (!_spi_active) {
+			_set_clock(SPI_CLOCK_DIVIDER_INSTANCE);
+		}
+
 		// If SPI in idle send the first byte
 		if (!_spi_active) {
 			_spi_active = 1;
@@ -268,7 +376,7 @@ uint8_t spi_send_byte(spi_p spi, uint8_t byte) {
 		#else
 		else {
 			// Check if buffer is free
-			if ( ((spi->_tx_buf != 0) && (BUFFER_SIZE - spi->_tx_buf->no_in_buffer)) || (spi->_tx_buf == 0) ) {
+			if ( (spi->_tx_buf != 0) && buffer_free_space(spi->_tx_buf) ) {
 				// Put in the tx buffer
 				buffer_put_item(spi->_tx_buf, byte);
 				}else {
@@ -296,6 +404,7 @@ uint8_t spi_send_byte(spi_p spi, uint8_t byte) {
 
 @return SPI_OK: OK byte send to SPI bus or put in tx_buffer.\n
 SPI_NO_ROOM_IN_TX_BUFFER: Buffer full no data send\n
+SPI_BUSY: another instance or a transaction is using the bus.\n
 SPI_ILLEGAL_INSTANCE: instance is null.
 @param spi to send to.
 @param *buf pointer to buffer to be send.
@@ -306,11 +415,6 @@ uint8_t spi_send_string(spi_p spi, uint8_t *buf, uint8_t len) {
 		return SPI_ILLEGAL_INSTANCE;
 	}
 
-	// Select correct instance
-	if (_this != spi ) {
-		_select_instance(spi);
-	}
-
 	uint8_t result = SPI_OK;
 	uint8_t tmp = 0;
 
@@ -320,8 +424,24 @@ uint8_t spi_send_string(spi_p spi, uint8_t *buf, uint8_t len) {
 		uint8_t c_sreg = SREG;
 		cli();
 
+		// Never switch CS in the middle of a transfer, and let queued transactions go first
+		if ((_transaction != 0) || (_queue_head != 0) || (_spi_active && (_this != spi))) {
+			SREG = c_sreg;
+			return SPI_BUSY;
+		}
+
+		// Select correct instance
+		if (_this != spi ) {
+			_select_instance(spi);
+		}
+		
+		// A transaction may have changed the clock
+		if (!_spi_active) {
+			_set_clock(SPI_CLOCK_DIVIDER_INSTANCE);
+		}
+
 		// Check if buffer is free
-		if ( ((spi->_tx_buf != 0) && (len > (BUFFER_SIZE - spi->_tx_buf->no_in_buffer))) || ((spi->_tx_buf == 0) && (len > 1)) ) {
+		if ( ((spi->_tx_buf != 0) && (len > buffer_free_space(spi->_tx_buf))) || ((spi->_tx_buf == 0) && ((len > 1) || _spi_active)) ) {
 			result = SPI_NO_ROOM_IN_TX_BUFFER;
 			} else {
 			// If SPI in idle send the first byte
@@ -335,9 +455,9 @@ uint8_t spi_send_string(spi_p spi, uint8_t *buf, uint8_t len) {
 
 				tmp = 1;
 			}
-			// Put in the tx buffer
-			for (uint8_t i = tmp; i < len; i++) {
-				buffer_put_item(spi->_tx_buf, buf[i]);
+			// Put the rest in the tx buffer
+			if (len > tmp) {
+				buffer_put_items(spi->_tx_buf, buf + tmp, len - tmp);
 			}
 		}
 
@@ -349,12 +469,259 @@ uint8_t spi_send_string(spi_p spi, uint8_t *buf, uint8_t len) {
 }
 #endif
 
+// Run a claimed transaction in a polled loop, interrupts are left as the caller had them
+static void _run_polled_transaction(spi_transaction_t *transaction) {
+	uint8_t *_rx = transaction->rx;
+	uint8_t _byte;
+
+	// Clear a pending SPIF from an earlier transfer
+	if (SPSR & _BV(SPIF)) {
+		_byte = SPDR;
+	}
+
+	for (uint16_t i = 0; i < transaction->len; i++) {
+		_spi_send_byte(_tx_byte(transaction, i));
+		while (!(SPSR & _BV(SPIF))) {
+		}
+		_byte = SPDR;
+		if (_rx != 0) {
+			_rx[i] = _byte;
+		}
+	}
+
+	// Critical section
+	{
+		// disable interrupt
+		uint8_t c_sreg = SREG;
+		cli();
+
+		_set_cs(CS_INACTIVE);
+		_spi_active = 0;
+		_transaction = 0;
+		transaction->status = SPI_TRANSACTION_DONE;
+
+		// Transactions queued while polling
+		_start_next_transaction();
+
+		// restore interrupt state
+		SREG = c_sreg;
+	}
+
+	if (transaction->call_back) {
+		// A transaction queued from the call back is interrupt driven, so call backs never nest
+		_in_polled_call_back = 1;
+		transaction->call_back(transaction);
+		_in_polled_call_back = 0;
+	}
+}
+
+/* ======================================================================================================================= */
+/**
+@ingroup spi_transaction
+@brief Queue a transaction.
+
+The transaction is started at once if the bus is idle, otherwise when the transactions before it are done.
+When the transaction is done, status is set to SPI_TRANSACTION_DONE and the call back is called from the ISR.
+The call back may queue a new transaction.
+
+If the bus is idle and the transaction is short (see SPI_POLLED_MAX_CYCLES) it is run polled: the function
+returns when the transaction is done, and the call back is called from the calling context.
+When called from an ISR the polled transaction runs with interrupts disabled.
+
+Example:
+@code
+static uint8_t tx[] = {0x80 | 0x3B, 0, 0, 0, 0, 0, 0};
+static uint8_t rx[sizeof tx];
+static spi_transaction_t read_acc = {.tx = tx, .rx = rx, .len = sizeof tx, .clock_divider = SPI_CLOCK_DIVIDER_2, .call_back = acc_read};
+
+read_acc.spi = spi_instance;
+spi_queue_transaction(&read_acc);
+@endcode
+
+@return SPI_OK: transaction queued or done.\n
+SPI_ILLEGAL_TRANSACTION: no instance, zero length or the transaction is already queued.
+
+@param *transaction pointer to the transaction. It is owned by the driver until it is done.
+*/
+uint8_t spi_queue_transaction(spi_transaction_t *transaction) {
+	if ((transaction == 0) || (transaction->spi == 0) || (transaction->len == 0)) {
+		return SPI_ILLEGAL_TRANSACTION;
+	}
+
+	uint8_t result = SPI_OK;
+	uint8_t polled = 0;
+
+	// Critical section
+	{
+		// disable interrupt
+		uint8_t c_sreg = SREG;
+		cli();
+
+		if ((transaction == _transaction) || (transaction->_next != 0) || (transaction == _queue_tail)) {
+			result = SPI_ILLEGAL_TRANSACTION;
+		} else if (!_spi_active && (_queue_head == 0) && !_in_polled_call_back && _POLLING_ALLOWED() && (transaction->len <= _polled_max_len(transaction))) {
+			// Claim the bus, all other users will see it busy while polling
+			if (_this != transaction->spi) {
+				_select_instance(transaction->spi);
+			}
+			_set_clock(transaction->clock_divider);
+			_transaction = transaction;
+			_spi_active = 1;
+			transaction->status = SPI_TRANSACTION_ACTIVE;
+			SPCR &= ~_BV(SPIE);
+			_set_cs(CS_ACTIVE);
+			polled = 1;
+		} else {
+			transaction->status = SPI_TRANSACTION_QUEUED;
+			if (_queue_tail) {
+				_queue_tail->_next = transaction;
+			} else {
+				_queue_head = transaction;
+			}
+			_queue_tail = transaction;
+
+			if (!_spi_active) {
+				_start_next_transaction();
+			}
+		}
+
+		// restore interrupt state
+		SREG = c_sreg;
+	}
+
+	if (polled) {
+		_run_polled_transaction(transaction);
+	}
+
+	return result;
+}
+
+#if SPI_BENCHMARK == 1
+#define _BENCHMARK_IDLE_US 10000UL
+
+// Count loops until the transaction is done or window_us has passed - the same loop finds the idle rate
+static uint32_t _benchmark_spin(spi_transaction_t *transaction, uint32_t window_us, uint32_t (*time_us)(void)) {
+	uint32_t _start = time_us();
+	uint32_t _loops = 0;
+
+	while ((transaction->status != SPI_TRANSACTION_DONE) && ((time_us() - _start) < window_us)) {
+		_loops++;
+	}
+
+	return _loops;
+}
+
+// Run the transaction count times in the current mode
+static uint8_t _benchmark_run(spi_transaction_t *transaction, uint16_t count, uint32_t (*time_us)(void), uint32_t idle_loops, spi_benchmark_t *result) {
+	uint32_t _spin_loops = 0;
+	uint32_t _start = time_us();
+
+	for (uint16_t i = 0; i < count; i++) {
+		// Fails if the last run did not finish in time
+		if (spi_queue_transaction(transaction) != SPI_OK) {
+			return SPI_ILLEGAL_TRANSACTION;
+		}
+		_spin_loops += _benchmark_spin(transaction, _BENCHMARK_IDLE_US, time_us);
+	}
+
+	uint32_t _elapsed_ms = (time_us() - _start + 500) / 1000;
+	if (_elapsed_ms == 0) {
+		_elapsed_ms = 1;
+	}
+	result->bytes_per_s = (uint32_t)count * transaction->len * 1000UL / _elapsed_ms;
+
+	// The loops the caller would have made without the transfers
+	uint32_t _idle = idle_loops * _elapsed_ms / (_BENCHMARK_IDLE_US / 1000);
+	result->cpu_load_percent = (_spin_loops >= _idle) ? 0 : 100 - (_spin_loops * 100 + _idle / 2) / _idle;
+
+	return SPI_OK;
+}
+
+/* ======================================================================================================================= */
+/**
+@ingroup spi_transaction
+@brief Measure the bytes/s and the CPU load of a transaction, run polled and interrupt driven.
+
+The transaction is run count times in each mode. The caller counts loops while it waits for each transaction,
+the CPU load is the share of the loops lost compared to 10 ms without transfers.
+
+@note Only included when SPI_BENCHMARK is 1.
+@note Must be called from a task at the highest priority with interrupts enabled. Other traffic on the bus and the
+other ISRs are counted in the load, so keep the rest of the system as quiet as possible.
+@note count * len must be below 4 million.
+
+@return SPI_OK: the results are in polled and interrupt.\n
+SPI_ILLEGAL_TRANSACTION: no instance, zero length, too long to be run polled, or a run did not finish within 10 ms.
+
+@param *transaction pointer to the transaction to measure, it must not be queued. The call back is called for every run.
+@param count no of times to run it in each mode.
+@param *time_us pointer to a function returning a free running time [us].
+@param *polled where the result of the polled mode is stored.
+@param *interrupt where the result of the interrupt driven mode is stored.
+*/
+uint8_t spi_benchmark(spi_transaction_t *transaction, uint16_t count, uint32_t (*time_us)(void), spi_benchmark_t *polled, spi_benchmark_t *interrupt) {
+	if ((transaction == 0) || (transaction->spi == 0) || (transaction->len == 0) || (transaction->len > _polled_max_len(transaction))) {
+		return SPI_ILLEGAL_TRANSACTION;
+	}
+
+	// Idle rate of the wait loop, on a transaction that never gets done
+	spi_transaction_t _never = {.status = SPI_TRANSACTION_QUEUED};
+	uint32_t _idle_loops = _benchmark_spin(&_never, _BENCHMARK_IDLE_US, time_us);
+
+	uint8_t _result = _benchmark_run(transaction, count, time_us, _idle_loops, polled);
+	if (_result == SPI_OK) {
+		_benchmark_interrupt_only = 1;
+		_result = _benchmark_run(transaction, count, time_us, _idle_loops, interrupt);
+		_benchmark_interrupt_only = 0;
+	}
+
+	return _result;
+}
+#endif
+
+// Handle a transferred byte of the current transaction
+static inline void _transaction_isr() {
+	spi_transaction_t *_done = _transaction;
+	uint8_t _rx = SPDR;
+	
+	if (_done->rx != 0) {
+		_done->rx[_transaction_index] = _rx;
+	}
+	
+	// more bytes to send?
+	if (++_transaction_index < _done->len) {
+		_spi_send_byte(_tx_byte(_done, _transaction_index));
+		return;
+	}
+
+	// Transaction done
+	SPCR &= ~_BV(SPIE);
+	_set_cs(CS_INACTIVE);
+	_spi_active = 0;
+	_transaction = 0;
+	_done->status = SPI_TRANSACTION_DONE;
+	
+	// Keep the bus busy
+	_start_next_transaction();
+	
+	if (_done->call_back) {
+		_done->call_back(_done);
+	}
+}
+
 /* ======================================================================================================================= */
 /**
 @todo Documentation
 */
 ISR(SPI_STC_vect) {
 	uint8_t item;
+	spi_p _inst = _this;
+
+	if (_transaction != 0) {
+		_transaction_isr();
+		return;
+	}
+
 	#if SPI_USE_BUFFER == 1
 	// store received byte if receive buffer available
 
@@ -382,8 +749,13 @@ ISR(SPI_STC_vect) {
 	#endif
 
 	// If handler defined - call it with instance and received byte.
-	if (_this->_call_back)
+	if (_inst->_call_back)
 	{
-		_this->_call_back(_this, item);
+		_inst->_call_back(_inst, item);
+	}
+
+	// Run queued transactions when the bus is released
+	if (!_spi_active) {
+		_start_next_transaction();
 	}
 }
\ No newline at end of file
@@ -36,13 +36,15 @@ typedef struct spi_struct *spi_p;
 @brief Division for F_CPU to give SPI-Clock
 @{
 	*/
-	#define SPI_CLOCK_DIVIDER_2 4
-	#define SPI_CLOCK_DIVIDER_4 0
-	#define SPI_CLOCK_DIVIDER_8 5
-	#define SPI_CLOCK_DIVIDER_16 1
-	#define SPI_CLOCK_DIVIDER_32 6
-	#define SPI_CLOCK_DIVIDER_64 2
-	#define SPI_CLOCK_DIVIDER_128 3
+	#define SPI_CLOCK_DIVIDER_2 5
+	#define SPI_CLOCK_DIVIDER_4 1
+	#define SPI_CLOCK_DIVIDER_8 6
+	#define SPI_CLOCK_DIVIDER_16 2
+	#define SPI_CLOCK_DIVIDER_32 7
+	#define SPI_CLOCK_DIVIDER_64 3
+	#define SPI_CLOCK_DIVIDER_128 4
+	/** @brief Transaction only: use the clock divider of the instance. */
+	#define SPI_CLOCK_DIVIDER_INSTANCE 0
 	/**
 @}
 
@@ -65,13 +67,61 @@ typedef struct spi_struct *spi_p;
 	#define SPI_BUSY 2
 	/** @brief The specified instance is > SPI_MAX_NO_OF_INSTANCES or is not instantiated yet. */
 	#define SPI_ILLEGAL_INSTANCE 3
+	/** @brief The transaction has no instance or zero length, or is already queued. */
+	#define SPI_ILLEGAL_TRANSACTION 4
 	/**
 @}
+
+\ingroup spi_transaction_status
+@{
+	@brief The transaction is waiting in the queue. */
+	#define SPI_TRANSACTION_QUEUED 0
+	/** @brief The transaction is on the bus. */
+	#define SPI_TRANSACTION_ACTIVE 1
+	/** @brief The transaction is completed. */
+	#define SPI_TRANSACTION_DONE 2
+	/**
+@}
+*/
+
+/**
+\ingroup spi_transaction
+@brief Describes one SPI transaction.
+
+The bytes are transferred directly from tx and into rx, the buffers are owned by the caller and must be kept
+until the transaction is done.
+*/
+typedef struct spi_transaction {
+	spi_p spi; /**< instance (device) to transfer with. */
+	const uint8_t *tx; /**< bytes to send, 0: send zeros. */
+	uint16_t tx_len; /**< no of bytes in tx, zeros are sent after them, 0: tx holds len bytes. */
+	uint8_t *rx; /**< where the received bytes are stored, 0: throw them away. */
+	uint16_t len; /**< no of bytes to transfer. */
+	uint8_t clock_divider; /**< SPI_CLOCK_DIVIDER_xx for this transaction, SPI_CLOCK_DIVIDER_INSTANCE: the clock of the instance. */
+	void(*call_back )(struct spi_transaction *transaction); /**< called from the ISR when the transaction is done, 0: no call back. */
+	void *arg; /**< free for the caller, e.g. a task to notify from the call back. */
+	volatile uint8_t status; /**< SPI_TRANSACTION_xx, set by the driver. */
+	struct spi_transaction *_next; /**< private for the driver. */
+} spi_transaction_t;
+
+#if SPI_BENCHMARK == 1
+/**
+\ingroup spi_transaction
+@brief Result of spi_benchmark() for one mode.
 */
+typedef struct {
+	uint32_t bytes_per_s; /**< bytes transferred per second, including queuing the transactions. */
+	uint8_t cpu_load_percent; /**< share of the CPU used while transferring, 100: no time left for the caller. */
+} spi_benchmark_t;
+#endif
 
 // ------------- Prototypes -----------------
 spi_p spi_new_instance(uint8_t mode, int8_t clock_divider, uint8_t spi_mode, uint8_t data_order, volatile uint8_t *cs_port, uint8_t cs_pin, uint8_t cs_active_level,
 buffer_struct_t *rx_buf, buffer_struct_t *tx_buf, void(*handler_call_back )(spi_p, uint8_t));
 uint8_t spi_send_byte(spi_p spi, uint8_t byte);
 uint8_t spi_send_string(spi_p spi, uint8_t buf[], uint8_t len);
+uint8_t spi_queue_transaction(spi_transaction_t *transaction);
+#if SPI_BENCHMARK == 1
+uint8_t spi_benchmark(spi_transaction_t *transaction, uint16_t count, uint32_t (*time_us)(void), spi_benchmark_t *polled, spi_benchmark_t *interrupt);
+#endif
 #endif /* SPI_H_ */
\ No newline at end of file
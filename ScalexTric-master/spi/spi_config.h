@@ -13,4 +13,22 @@ The configuration must be done at compile time.
 /** @brief Set to 1 if rx and tx buffer should be included. */
 #define SPI_USE_BUFFER 1
 
+/** @brief Max no of CPU cycles a transaction may take on the bus to be run polled instead of interrupt driven.
+
+Short transactions on an idle bus are run in a polled loop, because the ISR costs more cycles per byte than
+the transfer itself at high SPI clocks. Interrupts are left enabled between the bytes.
+The length limit is found from the clock divider of the instance, e.g. 32 bytes at F_CPU/2 and 2 bytes at F_CPU/32.
+0: all transactions are interrupt driven.
+
+@note When spi_queue_transaction() is called from an ISR (or with interrupts disabled), a polled transaction runs
+with interrupts disabled for all of it: SPI_POLLED_MAX_CYCLES (32 us at 16 MHz) plus the loop overhead per byte.
+E.g. the 15 byte IMU sample read from the data ready ISR holds the other interrupts for 240 bus cycles (15 us) plus overhead.
+Lower the limit if that latency is too high for the other ISRs. */
+#define SPI_POLLED_MAX_CYCLES 512
+
+/** @brief Set to 1 to include spi_benchmark(), which measures bytes/s and CPU load of the polled and the interrupt driven mode. */
+#ifndef SPI_BENCHMARK
+#define SPI_BENCHMARK 0
+#endif
+
 #endif /* SPI_IHA_DEFS_H_ */
\ No newline at end of file
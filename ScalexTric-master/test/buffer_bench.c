@@ -0,0 +1,109 @@
+/*
+ * buffer_bench.c
+ *
+ * Host benchmark of buffer_put_item()/buffer_get_item() on the mask (power of two size) and the compare
+ * (other sizes) index paths, against a reference buffer wrapping its indexes with % size as the per instance
+ * size would need without them.
+ * The counts are host TSC cycles, they show the relative cost of the paths - not AVR cycles.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "../buffer/buffer.h"
+
+#define ROUNDS 2000
+#define BURST 64
+
+// Reference - the original buffer with the size taken at run time
+typedef struct {
+	uint8_t *storage;
+	uint16_t size;
+	uint16_t in_i;
+	uint16_t out_i;
+	uint16_t no_in_buffer;
+} _mod_buffer_t;
+
+static __attribute__((noinline)) uint8_t _mod_put(_mod_buffer_t *b, uint8_t item) {
+	if (b->no_in_buffer < b->size) {
+		b->storage[b->in_i] = item;
+		b->in_i = (b->in_i + 1) % b->size;
+		b->no_in_buffer++;
+		return BUFFER_OK;
+	}
+	return BUFFER_FULL;
+}
+
+static __attribute__((noinline)) uint8_t _mod_get(_mod_buffer_t *b, uint8_t *item) {
+	if (b->no_in_buffer > 0) {
+		*item = b->storage[b->out_i];
+		b->out_i = (b->out_i + 1) % b->size;
+		b->no_in_buffer--;
+		return BUFFER_OK;
+	}
+	return BUFFER_EMPTY;
+}
+
+static uint8_t _storage[256];
+static volatile uint8_t _sink;
+
+// ----------------------------------------------------------------------------------------------------------------------
+// Best of ROUNDS, cycles per put + get pair
+static double _bench_buffer(uint16_t size, uint8_t spsc) {
+	buffer_struct_t _b;
+	uint64_t _best = UINT64_MAX;
+	uint8_t _item;
+
+	if (spsc) {
+		buffer_init_spsc(&_b, _storage, size);
+	} else {
+		buffer_init(&_b, _storage, size);
+	}
+	for (int r = 0; r < ROUNDS; r++) {
+		uint64_t _start = __rdtsc();
+		for (int i = 0; i < BURST; i++) {
+			buffer_put_item(&_b, (uint8_t)i);
+			buffer_get_item(&_b, &_item);
+			_sink = _item;
+		}
+		uint64_t _cycles = __rdtsc() - _start;
+		if (_cycles < _best) {
+			_best = _cycles;
+		}
+	}
+	return (double)_best / BURST;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static double _bench_mod(uint16_t size) {
+	_mod_buffer_t _b = {_storage, size, 0, 0, 0};
+	uint64_t _best = UINT64_MAX;
+	uint8_t _item;
+
+	for (int r = 0; r < ROUNDS; r++) {
+		uint64_t _start = __rdtsc();
+		for (int i = 0; i < BURST; i++) {
+			_mod_put(&_b, (uint8_t)i);
+			_mod_get(&_b, &_item);
+			_sink = _item;
+		}
+		uint64_t _cycles = __rdtsc() - _start;
+		if (_cycles < _best) {
+			_best = _cycles;
+		}
+	}
+	return (double)_best / BURST;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int main(void) {
+	printf("TSC cycles per put + get, best of %d x %d\n", ROUNDS, BURST);
+	printf("  %% size reference,  size 256 : %6.1f\n", _bench_mod(256));
+	printf("  %% size reference,  size 100 : %6.1f\n", _bench_mod(100));
+	printf("  mask,              size 256 : %6.1f\n", _bench_buffer(256, 0));
+	printf("  compare,           size 100 : %6.1f\n", _bench_buffer(100, 0));
+	printf("  spsc mask,         size 256 : %6.1f\n", _bench_buffer(256, 1));
+	printf("  spsc compare,      size 100 : %6.1f\n", _bench_buffer(100, 1));
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * buffer_spsc_test.c
+ *
+ * Host stress test of the single-producer/single-consumer buffer mode.
+ * A producer thread plays the ISR and a consumer thread plays the task, they share the buffer without any locks.
+ * The threads yield when the buffer is full or empty, so the test also runs on a single core.
+ * Every item carries a sequence no, so a lost, duplicated or torn item is seen by the consumer.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../buffer/buffer.h"
+
+#define ITEMS 2000000UL
+#define BULK_MAX 7
+
+static buffer_struct_t _buffer;
+static uint8_t _storage[BUFFER_SPSC_MAX_SIZE];
+static volatile unsigned long _errors = 0;
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void *_producer(void *arg) {
+	uint8_t _items[BULK_MAX];
+	unsigned long _seq = 0;
+	unsigned _rand = 1;
+
+	while (_seq < ITEMS) {
+		_rand = _rand * 1103515245 + 12345;
+		uint16_t _len = (_rand >> 16) % BULK_MAX + 1;
+		if (_len > ITEMS - _seq) {
+			_len = ITEMS - _seq;
+		}
+
+		if (_len == 1) {
+			if (buffer_put_item(&_buffer, (uint8_t)_seq) == BUFFER_OK) {
+				_seq++;
+			} else {
+				sched_yield();
+			}
+		} else {
+			for (uint16_t i = 0; i < _len; i++) {
+				_items[i] = (uint8_t)(_seq + i);
+			}
+			if (buffer_put_items(&_buffer, _items, _len) == BUFFER_OK) {
+				_seq += _len;
+			} else {
+				sched_yield();
+			}
+		}
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static void *_consumer(void *arg) {
+	uint8_t _items[BULK_MAX];
+	unsigned long _seq = 0;
+	unsigned _rand = 7;
+
+	while (_seq < ITEMS) {
+		_rand = _rand * 1103515245 + 12345;
+		uint16_t _len = (_rand >> 16) % BULK_MAX + 1;
+		if (_len > ITEMS - _seq) {
+			_len = ITEMS - _seq;
+		}
+
+		if (_len == 1) {
+			if (buffer_get_item(&_buffer, _items) != BUFFER_OK) {
+				sched_yield();
+				continue;
+			}
+		} else if (_len == 2) {
+			// Read in place
+			uint8_t *_span;
+			uint16_t _n = buffer_read_span(&_buffer, &_span);
+			if (_n == 0) {
+				sched_yield();
+				continue;
+			}
+			_len = (_n < BULK_MAX) ? _n : BULK_MAX;
+			if (_len > ITEMS - _seq) {
+				_len = ITEMS - _seq;
+			}
+			for (uint16_t i = 0; i < _len; i++) {
+				_items[i] = _span[i];
+			}
+			buffer_read_commit(&_buffer, _len);
+		} else if (buffer_get_items(&_buffer, _items, _len) != BUFFER_OK) {
+			sched_yield();
+			continue;
+		}
+
+		for (uint16_t i = 0; i < _len; i++, _seq++) {
+			if (_items[i] != (uint8_t)_seq) {
+				if (_errors++ < 10) {
+					printf("item %lu: got %u expected %u\n", _seq, _items[i], (uint8_t)_seq);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+static int _run(uint16_t size) {
+	pthread_t _p, _c;
+
+	_errors = 0;
+	buffer_init_spsc(&_buffer, _storage, size);
+	pthread_create(&_c, NULL, _consumer, NULL);
+	pthread_create(&_p, NULL, _producer, NULL);
+	pthread_join(_p, NULL);
+	pthread_join(_c, NULL);
+
+	if (!buffer_is_empty(&_buffer)) {
+		printf("size %u: buffer not empty at the end\n", size);
+		_errors++;
+	}
+	#if BUFFER_USE_STATISTICS == 1
+	buffer_statistics_t _stats;
+	buffer_get_statistics(&_buffer, &_stats);
+	if (_stats.puts != ITEMS || _stats.gets != ITEMS) {
+		printf("size %u: statistics puts %lu gets %lu\n", size, (unsigned long)_stats.puts, (unsigned long)_stats.gets);
+		_errors++;
+	}
+	#endif
+
+	printf("size %3u: %lu items, %lu errors\n", size, ITEMS, _errors);
+	return _errors != 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int main(void) {
+	int _failed = 0;
+
+	_failed |= _run(BUFFER_SPSC_MAX_SIZE); // mask indexing
+	_failed |= _run(100); // compare wrap
+	_failed |= _run(8); // nearly always full or empty
+
+	return _failed;
+}
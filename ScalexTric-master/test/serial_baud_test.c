@@ -0,0 +1,76 @@
+/*
+ * serial_baud_test.c
+ *
+ * Host test of serial_calc_baud() at F_CPU = 16 MHz.
+ * The expected values are from the baud rate tables in the ATmega2560 datasheet.
+ */
+
+#include <stdio.h>
+
+#include "../serial/serial.h"
+
+typedef struct {
+	uint32_t baud;
+	uint16_t ubrr;
+	uint8_t double_speed;
+	uint16_t error_permille;
+	uint8_t accepted; /**< within SERIAL_MAX_BAUD_ERROR_PERMILLE */
+} baud_case_t;
+
+static const baud_case_t _cases[] = {
+	{    9600, 103, 0,   2, 1 }, // 0.2%, normal speed preferred when U2X is no better
+	{   19200,  51, 0,   2, 1 },
+	{   38400,  25, 0,   2, 1 },
+	{   57600,  34, 1,   8, 1 }, // 0.8% with U2X, 2.1% without
+	{   81700,  11, 0,  20, 1 }, // 1.999% - rounded up to the limit
+	{   81633,  11, 0,  21, 0 }, // 2.083% - rounded up past the limit, truncated it was 20
+	{  115200,  16, 1,  22, 0 }, // 2.1% - rejected
+	{  250000,   3, 0,   0, 1 },
+	{  500000,   1, 0,   0, 1 },
+	{ 1000000,   0, 0,   0, 1 },
+	{ 2000000,   0, 1,   0, 1 }, // only with U2X
+};
+
+// ----------------------------------------------------------------------------------------------------------------------
+static int _check(const baud_case_t *c) {
+	uint16_t _ubrr = 0xFFFF;
+	uint8_t _double_speed = 0xFF;
+	uint16_t _error = serial_calc_baud(c->baud, &_ubrr, &_double_speed);
+	uint8_t _accepted = (_error <= SERIAL_MAX_BAUD_ERROR_PERMILLE);
+
+	if (_ubrr != c->ubrr || _double_speed != c->double_speed || _error != c->error_permille || _accepted != c->accepted) {
+		printf("%7lu baud: got UBRR %u U2X %u error %u, expected UBRR %u U2X %u error %u\n", (unsigned long)c->baud,
+			_ubrr, _double_speed, _error, c->ubrr, c->double_speed, c->error_permille);
+		return 1;
+	}
+	printf("%7lu baud: UBRR %4u U2X %u error %2u per mille %s\n", (unsigned long)c->baud, _ubrr, _double_speed, _error,
+		_accepted ? "" : "rejected");
+	return 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+int main(void) {
+	int _failed = 0;
+	uint16_t _ubrr;
+	uint8_t _double_speed;
+
+	for (unsigned i = 0; i < sizeof _cases / sizeof _cases[0]; i++) {
+		_failed |= _check(&_cases[i]);
+	}
+
+	// Rates that cannot be made at all
+	if (serial_calc_baud(0, &_ubrr, &_double_speed) != UINT16_MAX) {
+		printf("0 baud not rejected\n");
+		_failed = 1;
+	}
+	if (serial_calc_baud(100, &_ubrr, &_double_speed) != UINT16_MAX) {
+		printf("100 baud not rejected - UBRR out of range\n");
+		_failed = 1;
+	}
+	if (serial_calc_baud(8000000, &_ubrr, &_double_speed) <= SERIAL_MAX_BAUD_ERROR_PERMILLE) {
+		printf("8000000 baud not rejected\n");
+		_failed = 1;
+	}
+
+	return _failed;
+}
@@ -0,0 +1,6 @@
+/*
+ * io.h
+ *
+ * Empty stand-in for <avr/io.h> on the host.
+ * FreeRTOSConfig.h includes it, the hardware independent modules tested here do not use any registers.
+ */